@@ -0,0 +1,350 @@
+/**
+ * 局面の計算に関わる関数のマイクロベンチマーク
+ *
+ * 使い方:
+ *   ./bench/runbench [--corpus FILE] [--min-time MS] [--json FILE]
+ *   ./bench/runbench --record N > bench/corpus.txt  (局面集を作り直す)
+ *
+ * 局面集は、Pack (Pack::GetInput()の形式) と局面 (Position::GetInput()の形式) の組を並べたもの。
+ * 同じ局面集を同じ順番で計算するので、ビルド間で結果を比較できる。
+ *
+ * 局面集の局面は、試合から取ったものではなく、乱数で選んだPackを乱数で選んだ位置に落として作ったもの
+ * (RecordCorpus()を参照)。そのため、実際の試合の局面より連鎖の形になっていないものが多い。
+ * 試合の局面での探索性能は、bench/match.logを使うbench/replayで計測する。
+ */
+
+#include "../action.h"
+#include "../eval.h"
+#include "../pack.h"
+#include "../position.h"
+#include "../types.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+const char* kDEFAULT_CORPUS = "bench/corpus.txt";
+const double kDEFAULT_MIN_TIME = 300;  // 1つのベンチマークに掛ける最短時間 (ミリ秒)
+
+struct Record {
+  Pack pack;
+  Position position;
+};
+
+/**
+ * 1回分の計測対象。
+ * 実行すると、行った操作の数をops、そのうちPosition::Simulate()相当の計算の数をsimsに加える。
+ * simsが数えられないものは、負の値のままにする。
+ */
+struct Benchmark {
+  std::string name;
+  std::function<void(int64_t* ops, int64_t* sims)> run;
+};
+
+struct Result {
+  std::string name;
+  double ns_per_op;
+  double ops_per_sec;
+  double sims_per_sec;  // 数えられない場合は負の値
+};
+
+uint64_t checksum = 0;  // 計算が最適化で省かれないようにするため、結果を集める
+
+void Consume(const Score& score) {
+  checksum = checksum * 31 + score.chain_count + score.GetScoreSum();
+}
+
+std::vector<Record> LoadCorpus(const char* path) {
+  std::vector<Record> corpus;
+
+  std::ifstream file(path);
+  if (!file) {
+    return corpus;
+  }
+
+  // 既存の入力関数を使うため、標準入力を一時的に差し替える
+  std::streambuf* stdin_buf = std::cin.rdbuf(file.rdbuf());
+  while (true) {
+    std::cin >> std::ws;
+    if (std::cin.peek() == EOF) {
+      break;
+    }
+
+    Record record;
+    record.pack.GetInput();
+    record.position.GetInput();
+    corpus.push_back(record);
+  }
+  std::cin.rdbuf(stdin_buf);
+
+  return corpus;
+}
+
+/**
+ * 乱数で局面を進めて、局面集を作る。
+ * 連鎖の起きた局面も混ざるように、上の方まで積み上がるまで同じ局面を進める。
+ */
+void RecordCorpus(int num) {
+  std::mt19937 engine(20190428);
+
+  Position position;
+  int recorded = 0;
+  while (recorded < num) {
+    int values[4];
+    for (int i = 0; i < 4; i++) {
+      values[i] = engine() % 10;
+    }
+    Pack pack(values[0], values[1], values[2], values[3]);
+
+    Position next = position;
+    next.Simulate(pack, Action(NORMAL, engine() % 9, engine() % 4));
+    if (next.GetMaxHeight() > kHEIGHT - 2) {
+      position = Position();
+      continue;
+    }
+    position = next;
+
+    // 次のPackと現局面を書き出す
+    for (int i = 0; i < 4; i++) {
+      values[i] = engine() % 10;
+    }
+    printf("%d %d\n%d %d\nEND\n", values[0], values[1], values[2], values[3]);
+    for (int y = kDANGER_HEIGHT - kHEIGHT; y < kDANGER_HEIGHT; y++) {
+      for (int x = 0; x < kWIDTH; x++) {
+        printf((x == 0)? "%d" : " %d", (int)position.Get(y, x));
+      }
+      printf("\n");
+    }
+    printf("END\n");
+    recorded++;
+  }
+}
+
+std::vector<Benchmark> MakeBenchmarks(const std::vector<Record>& corpus) {
+  std::vector<Benchmark> benchmarks;
+
+  benchmarks.push_back({ "position_init", [](int64_t* ops, int64_t*) {
+    Position::Init();
+    (*ops)++;
+  }});
+
+  benchmarks.push_back({ "pack_init", [](int64_t* ops, int64_t*) {
+    Pack::Init();
+    (*ops)++;
+  }});
+
+  benchmarks.push_back({ "pack_get_rotated", [&corpus](int64_t* ops, int64_t*) {
+    for (const Record& record : corpus) {
+      for (int rotate = 0; rotate < 4; rotate++) {
+        checksum += record.pack.GetRotated(rotate).GetTopLine();
+        (*ops)++;
+      }
+    }
+  }});
+
+  benchmarks.push_back({ "simulate_normal", [&corpus](int64_t* ops, int64_t* sims) {
+    for (const Record& record : corpus) {
+      for (int column = 0; column < kWIDTH - 1; column++) {
+        for (int rotate = 0; rotate < 4; rotate++) {
+          Position position = record.position;
+          Consume(position.Simulate(record.pack, Action(NORMAL, column, rotate)));
+          (*ops)++;
+          (*sims)++;
+        }
+      }
+    }
+  }});
+
+  benchmarks.push_back({ "simulate_batch_normal", [&corpus](int64_t* ops, int64_t* sims) {
+    const int kACTION_NUM = 4 * (kWIDTH - 1);
+    Position positions[kACTION_NUM];
+    Pack packs[kACTION_NUM];
+    Action actions[kACTION_NUM];
+    Score scores[kACTION_NUM];
+    for (int i = 0; i < kACTION_NUM; i++) {
+      actions[i] = Action(NORMAL, i / 4, i % 4);
+    }
+
+    for (const Record& record : corpus) {
+      for (int i = 0; i < kACTION_NUM; i++) {
+        positions[i] = record.position;
+        packs[i] = record.pack;
+      }
+      Position::SimulateBatch(positions, packs, actions, scores, kACTION_NUM);
+      for (int i = 0; i < kACTION_NUM; i++) {
+        Consume(scores[i]);
+      }
+      (*ops) += kACTION_NUM;
+      (*sims) += kACTION_NUM;
+    }
+  }});
+
+  benchmarks.push_back({ "simulate_skill", [&corpus](int64_t* ops, int64_t* sims) {
+    for (const Record& record : corpus) {
+      Position position = record.position;
+      Consume(position.Simulate(Pack(), Action(SKILL)));
+      (*ops)++;
+      (*sims)++;
+    }
+  }});
+
+  // 一番下のブロックを1つ消し、Simulate()で盤面全体を落とす
+  benchmarks.push_back({ "simulate_no_action", [&corpus](int64_t* ops, int64_t* sims) {
+    for (const Record& record : corpus) {
+      for (int x = 0; x < kWIDTH; x++) {
+        if (record.position.GetHeight(x) < 2) {
+          continue;
+        }
+        Position position = record.position;
+        position.Set(kDANGER_HEIGHT - 1, x, 0);
+        Consume(position.Simulate(Pack(), Action(NO_ACTION_TYPE)));
+        (*ops)++;
+        (*sims)++;
+      }
+    }
+  }});
+
+  // simulate_no_actionと同じブロックを、SimulateErase()で消す (EraseOneの内側と同じ計算)
+  benchmarks.push_back({ "simulate_erase", [&corpus](int64_t* ops, int64_t* sims) {
+    for (const Record& record : corpus) {
+      for (int x = 0; x < kWIDTH; x++) {
+        if (record.position.GetHeight(x) < 2) {
+          continue;
+        }
+        Position position = record.position;
+        Consume(position.SimulateErase(kDANGER_HEIGHT - 1, x));
+        (*ops)++;
+        (*sims)++;
+      }
+    }
+  }});
+
+  benchmarks.push_back({ "attacked", [&corpus](int64_t* ops, int64_t* sims) {
+    for (const Record& record : corpus) {
+      Position position = record.position;
+      position.Attacked();
+      checksum += position.GetPackedCells(kDANGER_HEIGHT - 1);
+      (*ops)++;
+      (*sims)++;
+    }
+  }});
+
+  benchmarks.push_back({ "erase_one", [&corpus](int64_t* ops, int64_t*) {
+    for (const Record& record : corpus) {
+      Consume(Eval::EraseOne(record.position));
+      (*ops)++;
+    }
+  }});
+
+  return benchmarks;
+}
+
+Result Measure(const Benchmark& benchmark, double min_time) {
+  int64_t ops = 0;
+  int64_t sims = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  double elapsed = 0;
+  do {
+    benchmark.run(&ops, &sims);
+    elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  } while (elapsed < min_time);
+
+  Result result;
+  result.name = benchmark.name;
+  result.ns_per_op = elapsed * 1e6 / ops;
+  result.ops_per_sec = ops / (elapsed / 1000);
+  result.sims_per_sec = (sims > 0)? sims / (elapsed / 1000) : -1;
+  return result;
+}
+
+void WriteJson(const char* path, const std::vector<Result>& results, int corpus_size) {
+  FILE* file = fopen(path, "w");
+  if (file == nullptr) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return;
+  }
+
+  fprintf(file, "{\n  \"corpus_size\": %d,\n  \"benchmarks\": [\n", corpus_size);
+  for (int i = 0; i < (int)results.size(); i++) {
+    const Result& result = results[i];
+    fprintf(file, "    {\"name\": \"%s\", \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f", result.name.c_str(), result.ns_per_op, result.ops_per_sec);
+    if (result.sims_per_sec >= 0) {
+      fprintf(file, ", \"sims_per_sec\": %.0f", result.sims_per_sec);
+    }
+    fprintf(file, "}%s\n", (i + 1 < (int)results.size())? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+  fclose(file);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const char* corpus_path = kDEFAULT_CORPUS;
+  const char* json_path = nullptr;
+  double min_time = kDEFAULT_MIN_TIME;
+  int record_num = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--corpus") == 0 && i + 1 < argc) {
+      corpus_path = argv[++i];
+    } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      json_path = argv[++i];
+    } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+      min_time = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      record_num = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [--corpus FILE] [--min-time MS] [--json FILE] [--record N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  Pack::Init();
+  Position::Init();
+
+  if (record_num > 0) {
+    RecordCorpus(record_num);
+    return 0;
+  }
+
+  std::vector<Record> corpus = LoadCorpus(corpus_path);
+  if (corpus.empty()) {
+    fprintf(stderr, "empty corpus: %s\n", corpus_path);
+    return 1;
+  }
+
+  printf("corpus: %s (%d positions)\n", corpus_path, (int)corpus.size());
+  printf("%-24s %12s %14s %14s\n", "name", "ns/op", "ops/sec", "sims/sec");
+
+  std::vector<Result> results;
+  for (const Benchmark& benchmark : MakeBenchmarks(corpus)) {
+    Result result = Measure(benchmark, min_time);
+    results.push_back(result);
+
+    printf("%-24s %12.1f %14.0f ", result.name.c_str(), result.ns_per_op, result.ops_per_sec);
+    if (result.sims_per_sec >= 0) {
+      printf("%14.0f\n", result.sims_per_sec);
+    } else {
+      printf("%14s\n", "-");
+    }
+    fflush(stdout);
+  }
+  fprintf(stderr, "checksum: %016llx\n", (unsigned long long)checksum);
+
+  if (json_path != nullptr) {
+    WriteJson(json_path, results, corpus.size());
+  }
+
+  return 0;
+}
@@ -0,0 +1,268 @@
+/**
+ * 記録した試合の入力を、ターンごとにThink::Start()へ与えて探索性能を計測する。
+ *
+ * 使い方:
+ *   ./bench/replay [--log FILE] [--threads N] [--turns N] [--remain-time MS] [--depth N] [--expect FILE] [--write-expect FILE] [--json FILE]
+ *
+ * ログは、Game::GetInitInput()とGame::GetTurnInput()が読む標準入力の形式のまま保存したもの。
+ * --expectを与えると、各ターンで選んだ行動が記録と一致するかを確かめる。
+ * 時間切れで打ち切られた探索の結果は計算機の速さで変わるため、それ以降の不一致は警告に留める。
+ * --remain-timeで自分の残り時間を固定するとビームサーチを行わないようにでき、
+ * さらに--depthで深さ優先探索の深さを固定すると、結果が再現する。
+ */
+
+#include "../action.h"
+#include "../game.h"
+#include "../pack.h"
+#include "../position.h"
+#include "../think.h"
+#include "../types.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+const char* kDEFAULT_LOG = "bench/match.log";
+
+struct TurnResult {
+  int turn;
+  std::string action;
+  double elapsed;  // Think::Start()を呼んでから行動が返るまでの時間 (ミリ秒)
+  Think::Statistics statistics;
+};
+
+/**
+ * ログを読み込み、各ターンの入力を返す。
+ */
+std::vector<Game> LoadLog(const char* path) {
+  std::vector<Game> games;
+
+  std::ifstream file(path);
+  if (!file) {
+    return games;
+  }
+
+  // 既存の入力関数を使うため、標準入力を一時的に差し替える
+  std::streambuf* stdin_buf = std::cin.rdbuf(file.rdbuf());
+
+  Game game;
+  game.GetInitInput();
+  while (true) {
+    std::cin >> std::ws;
+    if (std::cin.peek() == EOF) {
+      break;
+    }
+
+    game.GetTurnInput();
+    games.push_back(game);
+  }
+  std::cin.rdbuf(stdin_buf);
+
+  return games;
+}
+
+std::vector<std::string> LoadExpect(const char* path) {
+  std::vector<std::string> actions;
+
+  std::ifstream file(path);
+  std::string line;
+  while (std::getline(file, line)) {
+    actions.push_back(line);
+  }
+
+  return actions;
+}
+
+/**
+ * 昇順に並んだvaluesのp分位点を返す。
+ */
+double Percentile(const std::vector<double>& values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  int index = std::min((int)values.size() - 1, (int)(p * values.size()));
+  return values[index];
+}
+
+void WriteJson(const char* path, const std::vector<TurnResult>& results, const std::vector<double>& latencies, int mismatch_count) {
+  FILE* file = fopen(path, "w");
+  if (file == nullptr) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return;
+  }
+
+  fprintf(file, "{\n  \"turns\": [\n");
+  for (int i = 0; i < (int)results.size(); i++) {
+    const TurnResult& result = results[i];
+    const Think::Statistics& statistics = result.statistics;
+    fprintf(file, "    {\"turn\": %d, \"action\": \"%s\", \"elapsed_ms\": %.3f, \"simulate_count\": %" PRId64 ", \"search_node_count\": %" PRId64 ", \"use_cache\": %s, \"time_budget_ms\": %.3f, \"search_depth\": %d, \"search_timeout\": %s, \"beam_depth\": %d, \"beam_width\": %d, \"beam_timeout\": %s, \"beam_reused_depth\": %d}%s\n",
+            result.turn, result.action.c_str(), result.elapsed,
+            statistics.simulate_count, statistics.search_node_count, statistics.use_cache? "true" : "false",
+            statistics.time_budget, statistics.search_depth, statistics.search_timeout? "true" : "false",
+            statistics.beam_depth, statistics.beam_width, statistics.beam_timeout? "true" : "false", statistics.beam_reused_depth,
+            (i + 1 < (int)results.size())? "," : "");
+  }
+  fprintf(file, "  ],\n");
+  fprintf(file, "  \"latency_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n",
+          Percentile(latencies, 0.5), Percentile(latencies, 0.9), Percentile(latencies, 0.99), Percentile(latencies, 1.0));
+  fprintf(file, "  \"mismatch_count\": %d\n}\n", mismatch_count);
+  fclose(file);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const char* log_path = kDEFAULT_LOG;
+  const char* expect_path = nullptr;
+  const char* write_expect_path = nullptr;
+  const char* json_path = nullptr;
+  int thread_num = 1;  // 既定では、結果が再現するように1スレッドで探索する
+  int turn_limit = kTURN_MAX;
+  int remain_time = -1;  // 負の場合は、ログの値をそのまま使う
+  int search_depth = 0;  // 0の場合は、持ち時間に応じて決める
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+      log_path = argv[++i];
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      thread_num = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--turns") == 0 && i + 1 < argc) {
+      turn_limit = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--remain-time") == 0 && i + 1 < argc) {
+      remain_time = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+      search_depth = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--expect") == 0 && i + 1 < argc) {
+      expect_path = argv[++i];
+    } else if (strcmp(argv[i], "--write-expect") == 0 && i + 1 < argc) {
+      write_expect_path = argv[++i];
+    } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      json_path = argv[++i];
+    } else {
+      fprintf(stderr, "usage: %s [--log FILE] [--threads N] [--turns N] [--remain-time MS] [--depth N] [--expect FILE] [--write-expect FILE] [--json FILE]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  Pack::Init();
+  Position::Init();
+  Think::Init(thread_num);
+  Think::SetSearchDepth(search_depth);
+
+  std::vector<Game> games = LoadLog(log_path);
+  if (games.empty()) {
+    fprintf(stderr, "empty log: %s\n", log_path);
+    return 1;
+  }
+  if ((int)games.size() > turn_limit) {
+    games.resize(turn_limit);
+  }
+  if (remain_time >= 0) {
+    for (Game& game : games) {
+      game.remain_time[WHITE] = remain_time;
+    }
+  }
+
+  std::vector<std::string> expected;
+  if (expect_path != nullptr) {
+    expected = LoadExpect(expect_path);
+  }
+
+  printf("log: %s (%d turns, %d threads)\n", log_path, (int)games.size(), thread_num);
+  printf("%5s %6s %10s %10s %12s %12s %12s %4s %6s %7s %s\n", "turn", "action", "ms", "budget", "simulates", "nodes", "nodes/sec", "dfs", "depth", "width", "note");
+
+  std::vector<TurnResult> results;
+  int mismatch_count = 0;
+  bool time_limited = false;  // これまでに時間切れで打ち切られた探索があったかどうか
+
+  for (const Game& game : games) {
+    auto start = std::chrono::steady_clock::now();
+    Action action = Think::Start(game);
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    TurnResult result;
+    result.turn = game.turn;
+    result.action = action.ToString();
+    result.elapsed = elapsed;
+    result.statistics = Think::GetStatistics();
+    results.push_back(result);
+
+    const Think::Statistics& statistics = result.statistics;
+    const double search_elapsed = elapsed - statistics.beam_elapsed;
+    const double nodes_per_sec = (search_elapsed > 0)? statistics.search_node_count / (search_elapsed / 1000) : 0;
+
+    std::string note = statistics.use_cache? "cache" : "";
+    if (statistics.beam_reused_depth > 0) {
+      note += " beam-reused";
+    }
+    if (statistics.beam_timeout) {
+      note += " beam-timeout";
+      time_limited = true;
+    }
+    if (statistics.search_timeout) {
+      note += " dfs-timeout";
+      time_limited = true;
+    }
+
+    const int index = results.size() - 1;
+    if (index < (int)expected.size() && expected[index] != result.action) {
+      if (time_limited) {
+        note += " differs (after timeout: " + expected[index] + ")";
+      } else {
+        note += " MISMATCH (expected: " + expected[index] + ")";
+        mismatch_count++;
+      }
+    }
+
+    printf("%5d %6s %10.1f %10.1f %12" PRId64 " %12" PRId64 " %12.0f %4d %6d %7d %s\n",
+           result.turn, result.action.c_str(), elapsed, statistics.time_budget, statistics.simulate_count, statistics.search_node_count,
+           nodes_per_sec, statistics.search_depth, statistics.beam_depth, statistics.beam_width, note.c_str());
+    fflush(stdout);
+  }
+
+  // 集計
+  std::vector<double> latencies;
+  double total_elapsed = 0, total_search_elapsed = 0;
+  int64_t total_simulates = 0, total_nodes = 0;
+  for (const TurnResult& result : results) {
+    latencies.push_back(result.elapsed);
+    total_elapsed += result.elapsed;
+    total_search_elapsed += result.elapsed - result.statistics.beam_elapsed;
+    total_simulates += result.statistics.simulate_count;
+    total_nodes += result.statistics.search_node_count;
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  printf("total: %.1f ms, %" PRId64 " simulates (%.0f /sec), %" PRId64 " nodes (%.0f /sec)\n",
+         total_elapsed, total_simulates, total_simulates / (total_elapsed / 1000),
+         total_nodes, (total_search_elapsed > 0)? total_nodes / (total_search_elapsed / 1000) : 0);
+  printf("time to action: p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+         Percentile(latencies, 0.5), Percentile(latencies, 0.9), Percentile(latencies, 0.99), Percentile(latencies, 1.0));
+
+  if (expect_path != nullptr) {
+    printf("determinism: %d mismatches in %d turns\n", mismatch_count, std::min((int)results.size(), (int)expected.size()));
+  }
+
+  if (write_expect_path != nullptr) {
+    FILE* file = fopen(write_expect_path, "w");
+    for (const TurnResult& result : results) {
+      fprintf(file, "%s\n", result.action.c_str());
+    }
+    fclose(file);
+  }
+
+  if (json_path != nullptr) {
+    WriteJson(json_path, results, latencies, mismatch_count);
+  }
+
+  return (mismatch_count == 0)? 0 : 1;
+}
@@ -0,0 +1,440 @@
+#include "bitboard.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+
+namespace {
+
+const uint64_t kNIBBLE_LSB_MASK = 0x1111111111ULL;  // 各升の最下位bit
+
+/**
+ * 下位bitから順に、maskのbitが立っている位置のbitを詰めて取り出す。
+ */
+inline uint32_t ParallelExtract(uint32_t value, uint32_t mask) {
+#ifdef SERVER
+  uint32_t result = 0;
+  for (uint32_t bit = 1; mask != 0; bit <<= 1) {
+    if (value & mask & -mask) {
+      result |= bit;
+    }
+    mask &= mask - 1;
+  }
+  return result;
+#else
+  return _pext_u32(value, mask);
+#endif
+}
+
+inline uint32_t PopCount(uint32_t value) {
+  return __builtin_popcount(value);
+}
+
+}  // namespace
+
+Bitboard::Bitboard() {
+  memset(planes, 0, sizeof(planes));
+}
+
+Bitboard::Bitboard(const Position& position) {
+  memset(planes, 0, sizeof(planes));
+
+  for (int y = 0; y < kDANGER_HEIGHT; y++) {
+    const PackedCells row = position.GetPackedCells(y);
+    if (row == 0ULL) {
+      continue;
+    }
+
+    const uint32_t bit = 1U << (kDANGER_HEIGHT - 1 - y);
+    for (int b = 0; b < kPLANE_NUM; b++) {
+      // 各升の第b bitは、4bitおきに並んでいる
+      uint64_t bits = row & (kNIBBLE_LSB_MASK << b);
+      while (bits != 0ULL) {
+        const int x = kWIDTH - 1 - __builtin_ctzll(bits) / 4;
+        planes[b][x] |= bit;
+        bits &= bits - 1;
+      }
+    }
+  }
+}
+
+void Bitboard::Store(Position* position) const {
+  for (int y = 0; y < kDANGER_HEIGHT; y++) {
+    const int r = kDANGER_HEIGHT - 1 - y;
+
+    PackedCells row = 0;
+    for (int x = 0; x < kWIDTH; x++) {
+      PackedCells cell = 0;
+      for (int b = 0; b < kPLANE_NUM; b++) {
+        cell |= (PackedCells)((planes[b][x] >> r) & 1U) << b;
+      }
+      row = (row << 4) | cell;
+    }
+    position->cells[y] = row;
+  }
+
+  for (int x = 0; x < kWIDTH; x++) {
+    const uint32_t occupied = planes[0][x] | planes[1][x] | planes[2][x] | planes[3][x];
+    position->heights[x] = (occupied == 0U)? 0 : 32 - __builtin_clz(occupied);
+  }
+}
+
+uint_fast64_t Bitboard::Get(int y, int x) const {
+  const int r = kDANGER_HEIGHT - 1 - y;
+
+  uint_fast64_t cell = 0;
+  for (int b = 0; b < kPLANE_NUM; b++) {
+    cell |= (uint_fast64_t)((planes[b][x] >> r) & 1U) << b;
+  }
+  return cell;
+}
+
+void Bitboard::Set(int y, int x, uint_fast64_t cell) {
+  const uint32_t bit = 1U << (kDANGER_HEIGHT - 1 - y);
+  for (int b = 0; b < kPLANE_NUM; b++) {
+    if ((cell >> b) & 1) {
+      planes[b][x] |= bit;
+    } else {
+      planes[b][x] &= ~bit;
+    }
+  }
+}
+
+void Bitboard::GetNumberMask(int num, uint32_t mask[kWIDTH]) const {
+  for (int x = 0; x < kWIDTH; x++) {
+    uint32_t m = kCOLUMN_MASK;
+    for (int b = 0; b < kPLANE_NUM; b++) {
+      m &= ((num >> b) & 1)? planes[b][x] : ~planes[b][x];
+    }
+    mask[x] = m;
+  }
+}
+
+void Bitboard::Drop() {
+  for (int x = 0; x < kWIDTH; x++) {
+    const uint32_t occupied = planes[0][x] | planes[1][x] | planes[2][x] | planes[3][x];
+
+    // 既に下に詰まっている列は何もしなくてよい
+    if ((occupied & (occupied + 1)) == 0) {
+      continue;
+    }
+
+    for (int b = 0; b < kPLANE_NUM; b++) {
+      planes[b][x] = ParallelExtract(planes[b][x], occupied);
+    }
+  }
+}
+
+bool Bitboard::Erase() {
+  uint32_t number_masks[10][kWIDTH];
+  for (int num = 1; num <= 9; num++) {
+    GetNumberMask(num, number_masks[num]);
+  }
+
+  // 最上段 (デンジャーラインの上) の横並びは、Position::Simulate()と同様に判定しない
+  const uint32_t kROW_MASK = kCOLUMN_MASK >> 1;
+
+  uint32_t disappear[kWIDTH] = { };
+  for (int num = 1; num <= 5; num++) {
+    const uint32_t* a = number_masks[num];
+    const uint32_t* b = number_masks[10 - num];
+
+    for (int x = 0; x < kWIDTH; x++) {
+      // 縦: aの上にb、bの上にa
+      uint32_t hit = a[x] & (b[x] >> 1);
+      disappear[x] |= hit | (hit << 1);
+      hit = b[x] & (a[x] >> 1);
+      disappear[x] |= hit | (hit << 1);
+
+      if (x + 1 < kWIDTH) {
+        // 横
+        hit = a[x] & b[x + 1] & kROW_MASK;
+        disappear[x] |= hit;
+        disappear[x + 1] |= hit;
+        hit = b[x] & a[x + 1] & kROW_MASK;
+        disappear[x] |= hit;
+        disappear[x + 1] |= hit;
+
+        // 右上
+        hit = a[x] & (b[x + 1] >> 1);
+        disappear[x] |= hit;
+        disappear[x + 1] |= (hit << 1);
+        hit = b[x] & (a[x + 1] >> 1);
+        disappear[x] |= hit;
+        disappear[x + 1] |= (hit << 1);
+
+        // 右下
+        hit = a[x] & (b[x + 1] << 1);
+        disappear[x] |= hit;
+        disappear[x + 1] |= (hit >> 1);
+        hit = b[x] & (a[x + 1] << 1);
+        disappear[x] |= hit;
+        disappear[x + 1] |= (hit >> 1);
+      }
+    }
+  }
+
+  uint32_t update = 0;
+  for (int x = 0; x < kWIDTH; x++) {
+    update |= disappear[x];
+    for (int b = 0; b < kPLANE_NUM; b++) {
+      planes[b][x] &= ~disappear[x];
+    }
+  }
+
+  return (update != 0);
+}
+
+Score Bitboard::ApplyAction(const Pack& pack, const Action& action) {
+  Score score;
+
+  if (action.action_type == SKILL) {
+    // 5のブロック及びその周囲8升のお邪魔でないブロックを消す
+    uint32_t fives[kWIDTH], ojamas[kWIDTH];
+    GetNumberMask(5, fives);
+    GetNumberMask(11, ojamas);
+
+    int block_count = 0;
+    for (int x = 0; x < kWIDTH; x++) {
+      uint32_t area = fives[x];
+      if (x > 0) {
+        area |= fives[x - 1];
+      }
+      if (x + 1 < kWIDTH) {
+        area |= fives[x + 1];
+      }
+      area = (area | (area << 1) | (area >> 1)) & kCOLUMN_MASK;
+
+      const uint32_t occupied = planes[0][x] | planes[1][x] | planes[2][x] | planes[3][x];
+      const uint32_t disappear = area & occupied & ~ojamas[x];
+      block_count += PopCount(disappear);
+
+      for (int b = 0; b < kPLANE_NUM; b++) {
+        planes[b][x] &= ~disappear;
+      }
+    }
+
+    score.explosion_score += floor(25 * pow(2.0, block_count / 12.0));
+    if (block_count == 0) {
+      score.explosion_score = 0;
+    }
+
+  } else if (action.action_type == NORMAL) {
+    Pack rotate_pack = pack.GetRotated(action.rotate);
+
+    // デンジャーラインの上に置いてから落とす
+    const uint32_t top_bit = 1U << (kDANGER_HEIGHT - 1);
+    const uint32_t bottom_bit = 1U << (kDANGER_HEIGHT - 2);
+    const uint_fast16_t top = rotate_pack.GetTopLine();
+    const uint_fast16_t bottom = rotate_pack.GetBottomLine();
+
+    for (int b = 0; b < kPLANE_NUM; b++) {
+      if ((top >> (4 + b)) & 1) { planes[b][action.column] |= top_bit; }
+      if ((top >> b) & 1) { planes[b][action.column + 1] |= top_bit; }
+      if ((bottom >> (4 + b)) & 1) { planes[b][action.column] |= bottom_bit; }
+      if ((bottom >> b) & 1) { planes[b][action.column + 1] |= bottom_bit; }
+    }
+  }
+
+  return score;
+}
+
+Score Bitboard::Simulate(const Pack& pack, const Action& action) {
+  Score score = ApplyAction(pack, action);
+
+  int chains = 0;
+  while (true) {
+    Drop();
+
+    if (!Erase()) {
+      // 消えたブロックがなければ、連鎖終了
+      break;
+    }
+
+    chains++;
+  }
+
+  score.chain_score = Position::GetChainScore(chains);
+  score.chain_count = chains;
+  return score;
+}
+
+void Bitboard::SimulateBatch(Position positions[], const Pack packs[], const Action actions[], Score scores[], int n) {
+  // planes[b][x][lane]: 局面をまたいで同じ位置の値を連続して並べる (struct of arrays)
+  alignas(64) uint32_t planes[kPLANE_NUM][kWIDTH][kBATCH_SIZE];
+  alignas(64) uint32_t number_masks[10][kWIDTH][kBATCH_SIZE];
+  alignas(64) uint32_t disappear[kWIDTH][kBATCH_SIZE];
+  alignas(64) uint32_t update[kBATCH_SIZE];
+  int chains[kBATCH_SIZE];
+  bool active[kBATCH_SIZE];
+
+  const uint32_t kROW_MASK = kCOLUMN_MASK >> 1;
+
+  for (int begin = 0; begin < n; begin += kBATCH_SIZE) {
+    const int size = std::min(kBATCH_SIZE, n - begin);
+
+    memset(planes, 0, sizeof(planes));
+    for (int lane = 0; lane < size; lane++) {
+      Bitboard bitboard(positions[begin + lane]);
+      scores[begin + lane] = bitboard.ApplyAction(packs[begin + lane], actions[begin + lane]);
+
+      for (int b = 0; b < kPLANE_NUM; b++) {
+        for (int x = 0; x < kWIDTH; x++) {
+          planes[b][x][lane] = bitboard.planes[b][x];
+        }
+      }
+      chains[lane] = 0;
+      active[lane] = true;
+    }
+
+    int active_num = size;
+    while (active_num > 0) {
+      // 連鎖が続いている局面のみ、ブロックを落とす
+      for (int lane = 0; lane < size; lane++) {
+        if (!active[lane]) {
+          continue;
+        }
+
+        for (int x = 0; x < kWIDTH; x++) {
+          const uint32_t occupied = planes[0][x][lane] | planes[1][x][lane] | planes[2][x][lane] | planes[3][x][lane];
+          if ((occupied & (occupied + 1)) == 0) {
+            continue;
+          }
+
+          for (int b = 0; b < kPLANE_NUM; b++) {
+            planes[b][x][lane] = ParallelExtract(planes[b][x][lane], occupied);
+          }
+        }
+      }
+
+      // 消去判定は全ての局面でまとめて行う
+      // 連鎖が終了した局面は消えるブロックがないので、そのまま計算しても結果は変わらない
+      for (int num = 1; num <= 9; num++) {
+        for (int x = 0; x < kWIDTH; x++) {
+          for (int lane = 0; lane < kBATCH_SIZE; lane++) {
+            uint32_t m = kCOLUMN_MASK;
+            for (int b = 0; b < kPLANE_NUM; b++) {
+              m &= ((num >> b) & 1)? planes[b][x][lane] : ~planes[b][x][lane];
+            }
+            number_masks[num][x][lane] = m;
+          }
+        }
+      }
+
+      memset(disappear, 0, sizeof(disappear));
+      for (int num = 1; num <= 5; num++) {
+        for (int x = 0; x < kWIDTH; x++) {
+          for (int lane = 0; lane < kBATCH_SIZE; lane++) {
+            const uint32_t a = number_masks[num][x][lane];
+            const uint32_t b = number_masks[10 - num][x][lane];
+
+            // 縦
+            uint32_t hit = (a & (b >> 1)) | (b & (a >> 1));
+            disappear[x][lane] |= hit | (hit << 1);
+
+            if (x + 1 < kWIDTH) {
+              const uint32_t na = number_masks[num][x + 1][lane];
+              const uint32_t nb = number_masks[10 - num][x + 1][lane];
+
+              // 横
+              hit = ((a & nb) | (b & na)) & kROW_MASK;
+              disappear[x][lane] |= hit;
+              disappear[x + 1][lane] |= hit;
+
+              // 右上
+              hit = (a & (nb >> 1)) | (b & (na >> 1));
+              disappear[x][lane] |= hit;
+              disappear[x + 1][lane] |= (hit << 1);
+
+              // 右下
+              hit = (a & (nb << 1)) | (b & (na << 1));
+              disappear[x][lane] |= hit;
+              disappear[x + 1][lane] |= (hit >> 1);
+            }
+          }
+        }
+      }
+
+      memset(update, 0, sizeof(update));
+      for (int x = 0; x < kWIDTH; x++) {
+        for (int lane = 0; lane < kBATCH_SIZE; lane++) {
+          update[lane] |= disappear[x][lane];
+          for (int b = 0; b < kPLANE_NUM; b++) {
+            planes[b][x][lane] &= ~disappear[x][lane];
+          }
+        }
+      }
+
+      active_num = 0;
+      for (int lane = 0; lane < size; lane++) {
+        active[lane] = (update[lane] != 0);
+        if (active[lane]) {
+          chains[lane]++;
+          active_num++;
+        }
+      }
+    }
+
+    for (int lane = 0; lane < size; lane++) {
+      Bitboard bitboard;
+      for (int b = 0; b < kPLANE_NUM; b++) {
+        for (int x = 0; x < kWIDTH; x++) {
+          bitboard.planes[b][x] = planes[b][x][lane];
+        }
+      }
+      bitboard.Store(&positions[begin + lane]);
+
+      scores[begin + lane].chain_score = Position::GetChainScore(chains[lane]);
+      scores[begin + lane].chain_count = chains[lane];
+    }
+  }
+}
+
+bool Bitboard::IsGameOver() const {
+  // 上から3段目 (Positionのcells[2]) にブロックがあるかどうか
+  const uint32_t bit = 1U << (kDANGER_HEIGHT - 3);
+  for (int x = 0; x < kWIDTH; x++) {
+    if ((planes[0][x] | planes[1][x] | planes[2][x] | planes[3][x]) & bit) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Bitboard::Attacked(int attack_num) {
+  if (attack_num == 0) {
+    return;
+  }
+
+  for (int i = 0; i < attack_num; i++) {
+    const uint32_t bit = 1U << (kDANGER_HEIGHT - 1 - i);
+
+    bool is_empty = true;
+    for (int x = 0; x < kWIDTH; x++) {
+      if ((planes[0][x] | planes[1][x] | planes[2][x] | planes[3][x]) & bit) {
+        is_empty = false;
+      }
+    }
+    if (!is_empty) {
+      break;
+    }
+
+    // 1段お邪魔 (11 = 0b1011)
+    for (int x = 0; x < kWIDTH; x++) {
+      planes[0][x] |= bit;
+      planes[1][x] |= bit;
+      planes[3][x] |= bit;
+    }
+  }
+
+  Simulate(Pack(), Action(NO_ACTION_TYPE));
+}
+
+bool Bitboard::operator==(const Bitboard& bitboard) const {
+  return memcmp(planes, bitboard.planes, sizeof(planes)) == 0;
+}
+
+bool Bitboard::operator!=(const Bitboard& bitboard) const {
+  return !(bitboard == *this);
+}
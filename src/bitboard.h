@@ -0,0 +1,92 @@
+#ifndef BITBOARD_H_
+#define BITBOARD_H_
+
+#include "types.h"
+#include "action.h"
+#include "pack.h"
+#include "score.h"
+#include "position.h"
+#include <cinttypes>
+
+/**
+ * Positionと同じ局面を、列優先のbitplaneで管理するクラス
+ *
+ * planes[b][x]は x列目の各ブロックの値の第b bitを集めたもので、
+ * bit rが (kDANGER_HEIGHT - 1 - r)行目に対応する (下がbit 0)。
+ * こうすることで、
+ *  - 落下処理は、各列でブロックのあるbitをpextで下に詰めるだけでよく、
+ *  - 消去判定は、数字ごとのマスクを盤面全体でshiftしてANDを取るだけでよい。
+ */
+class Bitboard {
+private:
+  static inline const int kPLANE_NUM = 4;
+  static inline const int kBATCH_SIZE = 16;  // SimulateBatch()で同時に計算する局面の数
+  static inline const uint32_t kCOLUMN_MASK = (1U << kDANGER_HEIGHT) - 1;
+
+  uint32_t planes[kPLANE_NUM][kWIDTH];
+
+  /**
+   * 数字numであるブロックの位置を、列ごとにmaskへ格納する。
+   */
+  void GetNumberMask(int num, uint32_t mask[kWIDTH]) const;
+
+  /**
+   * ブロックを落とす。
+   */
+  void Drop();
+
+  /**
+   * 消えるブロックを消す。
+   * 消えたブロックがあった場合はtrueを返す。
+   */
+  bool Erase();
+
+  /**
+   * 連鎖の前までの処理 (packの配置、スキルによる消去) を行う。
+   */
+  Score ApplyAction(const Pack& pack, const Action& action);
+
+public:
+  Bitboard();
+  explicit Bitboard(const Position& position);
+
+  /**
+   * 局面をpositionに書き出す。
+   */
+  void Store(Position* position) const;
+
+  /**
+   * (y, x)のブロックを取得する。
+   */
+  uint_fast64_t Get(int y, int x) const;
+
+  /**
+   * (y, x)にcellを設定する。
+   */
+  void Set(int y, int x, uint_fast64_t cell);
+
+  /**
+   * PackをActionで指定された状態で落とす。
+   * 結果はPosition::Simulate()と一致する。
+   */
+  Score Simulate(const Pack& pack, const Action& action);
+
+  /**
+   * n個の局面positions[i]に、packs[i]をactions[i]で落とす処理をまとめて行い、得点をscores[i]に格納する。
+   * 局面を(bit, 列, 局面)の順に並べ、落下と消去の1段階ずつを全局面に対して同時に計算する。
+   * 連鎖が終了した局面は、それ以降の落下処理を省く。
+   */
+  static void SimulateBatch(Position positions[], const Pack packs[], const Action actions[], Score scores[], int n);
+
+  bool IsGameOver() const;
+
+  /**
+   * お邪魔ブロックの落下処理。
+   */
+  void Attacked(int attack_num = 1);
+
+  bool operator==(const Bitboard& bitboard) const;
+  bool operator!=(const Bitboard& bitboard) const;
+};
+
+#endif  // BITBOARD_H_
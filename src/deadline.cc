@@ -0,0 +1,37 @@
+#include "deadline.h"
+#include "stats.h"
+
+Deadline::Deadline(): limit(std::chrono::steady_clock::now()), stopped(false) { }
+
+void Deadline::Start(double budget) {
+  limit = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(budget));
+  stopped = false;
+}
+
+void Deadline::Stop() {
+  stopped = true;
+}
+
+bool Deadline::CheckClock() {
+  Stats::Add(Stats::TIME_CHECK_COUNT);
+
+#ifdef STATS
+  const auto begin = std::chrono::steady_clock::now();
+#endif
+
+  const auto now = std::chrono::steady_clock::now();
+
+#ifdef STATS
+  // 時刻の確認に掛かった時間として、直前に読んだ時刻からの経過時間を数える
+  Stats::Add(Stats::TIME_CHECK_NANOSEC, std::chrono::duration_cast<std::chrono::nanoseconds>(now - begin).count());
+#endif
+
+  if (now >= limit) {
+    stopped = true;
+  }
+  return stopped.load(std::memory_order_relaxed);
+}
+
+double Deadline::Remaining() const {
+  return std::chrono::duration<double, std::milli>(limit - std::chrono::steady_clock::now()).count();
+}
@@ -0,0 +1,62 @@
+#ifndef DEADLINE_H_
+#define DEADLINE_H_
+
+#include <atomic>
+#include <chrono>
+
+/**
+ * 探索を打ち切る期限。
+ *
+ * 時刻の確認はスレッドごとにkCHECK_INTERVAL回に1回だけ行い、残りは共有のフラグを読むだけで済ませる。
+ * いずれかのスレッドが期限を過ぎたことに気づくか、Stop()が呼ばれるとフラグが立ち、
+ * 全てのスレッドが次のIsExpired()で止まる。
+ */
+class Deadline {
+private:
+  static inline const int kCHECK_INTERVAL = 64;  // 何回に1回時刻を確認するか
+
+  std::chrono::steady_clock::time_point limit;
+  std::atomic<bool> stopped;
+
+  /**
+   * 時刻を確認し、期限を過ぎていればフラグを立てる。
+   */
+  bool CheckClock();
+
+public:
+  Deadline();
+
+  /**
+   * 今からbudgetミリ秒後を期限とする。
+   */
+  void Start(double budget);
+
+  /**
+   * 期限を待たずに打ち切る。
+   * 他のスレッドから呼んでもよい。
+   */
+  void Stop();
+
+  /**
+   * 期限を過ぎたか、打ち切られた場合にtrueを返す。
+   */
+  bool IsExpired() {
+    if (stopped.load(std::memory_order_relaxed)) {
+      return true;
+    }
+
+    thread_local int countdown = 0;
+    if (--countdown > 0) {
+      return false;
+    }
+    countdown = kCHECK_INTERVAL;
+    return CheckClock();
+  }
+
+  /**
+   * 期限までの残り時間をミリ秒で返す。
+   */
+  double Remaining() const;
+};
+
+#endif  // DEADLINE_H_
@@ -1,81 +1,121 @@
 #include "eval.h"
+#include "stats.h"
+
+#include <algorithm>
+
+namespace {
+
+/**
+ * EraseOne()で消してみるブロックを、(y, x)の昇順にfuncへ渡す。
+ *
+ * 局面は落下済みなので、ブロックの有無は列の高さだけで判定できる。
+ * top(x) = kDANGER_HEIGHT - GetHeight(x)とすると、(y, x)を消してみる条件は
+ *  - ブロックがあり、その上にもブロックがある: y >= top(x) + 1
+ *  - 左下か右下にブロックがある: y >= min(top(x - 1), top(x + 1)) - 1
+ *  - 左、右、左上、右上のいずれかが空: y <= max(top(x - 1), top(x + 1))
+ * であり、列ごとに消してみるyの範囲が決まる。
+ */
+template <class Func>
+void ForEachEraseCandidate(const Position& position, bool ignore_bottom, int target_column, Func func) {
+  int tops[kWIDTH];
+  for (int x = 0; x < kWIDTH; x++) {
+    tops[x] = kDANGER_HEIGHT - position.GetHeight(x);
+  }
 
-#include <random>
-
-Score Eval::EraseOne(const Position& current_position, bool ignore_bottom, Point* erase_point, int* erase_number, int target_column) {
-  Score score_max = Score();
-
-  for (int y = 4; y < kDANGER_HEIGHT; y++) {
-    if (current_position.GetPackedCells(y) == 0ULL) {
+  int lows[kWIDTH], highs[kWIDTH];
+  int y_begin = kDANGER_HEIGHT, y_end = 0;
+  for (int x = 0; x < kWIDTH; x++) {
+    lows[x] = kDANGER_HEIGHT;
+    highs[x] = -1;
+    if (target_column != -1 && x != target_column) {
       continue;
     }
 
-    if (ignore_bottom && y >= kDANGER_HEIGHT - 2) {
-      continue;
+    // 盤面の下端より下は、ブロックがあるものとして扱う
+    int neighbor_min = kDANGER_HEIGHT + 1, neighbor_max = -1;
+    if (x > 0) {
+      neighbor_min = std::min(neighbor_min, tops[x - 1]);
+      neighbor_max = std::max(neighbor_max, tops[x - 1]);
+    }
+    if (x < kWIDTH - 1) {
+      neighbor_min = std::min(neighbor_min, tops[x + 1]);
+      neighbor_max = std::max(neighbor_max, tops[x + 1]);
+    }
+
+    lows[x] = std::max({ 4, tops[x] + 1, neighbor_min - 1 });
+    highs[x] = std::min(ignore_bottom? kDANGER_HEIGHT - 3 : kDANGER_HEIGHT - 1, neighbor_max);
+    if (lows[x] <= highs[x]) {
+      y_begin = std::min(y_begin, lows[x]);
+      y_end = std::max(y_end, highs[x] + 1);
     }
+  }
 
+  for (int y = y_begin; y < y_end; y++) {
     for (int x = 0; x < kWIDTH; x++) {
-      if (target_column != -1 && x != target_column) {
+      if (y < lows[x] || y > highs[x]) {
         continue;
       }
 
-      const int dy[4] = { -1, -1,  0, 0 };
-      const int dx[4] = { -1,  1, -1, 1 };
-
-      int target_cell = current_position.Get(y, x);
-      if (target_cell == 0 || target_cell == 11) {
+      const int number = position.Get(y, x);
+      if (number == 11) {
         continue;
       }
 
-      // 上に何もないブロックを消さない
-      if (current_position.Get(y - 1, x) == 0ULL) {
-        continue;
-      }
+      func(y, x, number);
+    }
+  }
+}
 
-      // 左下と右下に何もないブロックを消さない
-      if (y > 0) {
-        if ((x == 0 || current_position.Get(y + 1, x - 1) == 0ULL) &&
-            (x == kWIDTH - 1 || current_position.Get(y + 1, x + 1) == 0ULL)) {
-          continue;
-        }
-      }
+}  // namespace
 
-      bool is_adjacent_empty = false;
-      for (int i = 0; i < 4; i++) {
-        int ny = y + dy[i];
-        int nx = x + dx[i];
-        if (ny < 0 || ny >= kDANGER_HEIGHT || nx < 0 || nx >= kWIDTH) {
-          continue;
-        }
-
-        if (current_position.Get(ny, nx) == 0) {
-          is_adjacent_empty = true;
-          break;
-        }
-      }
+Score Eval::EraseOne(const Position& current_position, bool ignore_bottom, Point* erase_point, int* erase_number, int target_column) {
+  Stats::Add(Stats::ERASE_ONE_COUNT);
 
-      if (!is_adjacent_empty) {
-        continue;
+  Score score_max = Score();
+
+  ForEachEraseCandidate(current_position, ignore_bottom, target_column, [&](int y, int x, int number) {
+    Stats::Add(Stats::ERASE_ONE_CANDIDATE_COUNT);
+
+    Position position = current_position;
+    Score score = position.SimulateErase(y, x);
+    if (score.GetScoreSum() > score_max.GetScoreSum()) {
+      score_max = score;
+
+      if (erase_point != nullptr) {
+        *erase_point = Point(y, x);
       }
+      if (erase_number != nullptr) {
+        *erase_number = number;
+      }
+    }
+  });
+
+  return score_max;
+}
 
-      Position position = current_position;
+int Eval::EraseTopK(const Position& current_position, EraseResult results[], int k, bool ignore_bottom, int target_column) {
+  Stats::Add(Stats::ERASE_ONE_COUNT);
 
-      int erase_num = position.Get(y, x);
-      position.Set(y, x, 0);
+  int result_num = 0;
+  ForEachEraseCandidate(current_position, ignore_bottom, target_column, [&](int y, int x, int number) {
+    Stats::Add(Stats::ERASE_ONE_CANDIDATE_COUNT);
 
-      Score score = position.Simulate(Pack(), Action(NO_ACTION_TYPE));
-      if (score.GetScoreSum() > score_max.GetScoreSum()) {
-        score_max = score;
+    Position position = current_position;
+    const Score score = position.SimulateErase(y, x);
 
-        if (erase_point != nullptr) {
-          *erase_point = Point(y, x);
-        }
-        if (erase_number != nullptr) {
-          *erase_number = erase_num;
-        }
+    // 得点の降順、同点なら(y, x)の昇順に並べる
+    int i = std::min(result_num, k);
+    if (i == k && (k == 0 || score.GetScoreSum() <= results[k - 1].score.GetScoreSum())) {
+      return;
+    }
+    for (; i > 0 && results[i - 1].score.GetScoreSum() < score.GetScoreSum(); i--) {
+      if (i < k) {
+        results[i] = results[i - 1];
       }
     }
-  }
+    results[i] = EraseResult{ score, Point(y, x), number };
+    result_num = std::min(result_num + 1, k);
+  });
 
-  return score_max;
+  return result_num;
 }
@@ -8,12 +8,28 @@
 
 namespace Eval {
 
+/**
+ * ブロックを1つ消した結果
+ */
+struct EraseResult {
+  Score score;
+  Point erase_point;
+  int erase_number;
+};
+
 /**
  * 周囲に空きがあるセルを一つ消し、得点を計算する。
  * それらの得点の最大得点を返す。
  */
 Score EraseOne(const Position& current_position, bool ignore_bottom = false, Point* erase_point = nullptr, int* erase_number = nullptr, int target_column = -1);
 
+/**
+ * EraseOne()と同じブロックを消してみて、得点の高い順にk個までresultsに格納する。
+ * 同点の場合は(y, x)の小さい順に並べるので、最大得点が正であればresults[0]はEraseOne()の結果と一致する。
+ * 格納した個数を返す。
+ */
+int EraseTopK(const Position& current_position, EraseResult results[], int k, bool ignore_bottom = false, int target_column = -1);
+
 }  // namespace Eval
 
 #endif  // EVAL_H_
@@ -3,12 +3,29 @@
 #include "think.h"
 #include "action.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
-int main() {
+int main(int argc, char* argv[]) {
+  int thread_num = Think::kDEFAULT_THREAD_NUM;
+  bool ponder = false;
+  for (int i = 1; i < argc; i++) {
+    // --threads N で探索に用いるスレッド数を指定する
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      thread_num = std::max(1, atoi(argv[++i]));
+    }
+
+    // --ponder で、相手の思考中に次のターンの探索を先に進める
+    if (strcmp(argv[i], "--ponder") == 0) {
+      ponder = true;
+    }
+  }
+
   Pack::Init();
   Position::Init();
-  Think::Init();
+  Think::Init(thread_num);
 
   // はじめに、名前を出力
   std::cout << "nyashiki" << std::endl;
@@ -23,6 +40,12 @@ int main() {
 
   while (true) {
     game.GetTurnInput();
+    Think::StopPondering();  // 入力を受け取ったら、先読みを打ち切る
+
+    // 入力が終了した (対戦が終わった) 場合
+    if (!std::cin) {
+      break;
+    }
 
     /**
      * デバッグ用
@@ -46,6 +69,10 @@ int main() {
     Action next_action = Think::Start(game);  // 自分の行動を探索
     std::cout << next_action.ToString() << std::endl;  // 標準出力に次の行動を出力
 
+    if (ponder) {
+      Think::StartPondering(game, next_action);
+    }
+
     /**
      * デバッグ用
      * なるはずの局面を用意しておく。
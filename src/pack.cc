@@ -1,39 +1,141 @@
 #include "pack.h"
 
-#include <cstring>
 #include <cassert>
 #include <iostream>
 
 namespace {
 
-bool flammable_patterns[0xFFFF];  // 置くだけで1連鎖になってしまうpackたち
-int number_count_table[10][0xFFFF];  // ある数字がこのpackに何個含まれているかを返す
+/**
+ * Pack::GetRotated()などの、packを表す16bitに対する計算
+ * 表をコンパイル時に作るために、constexprで定義しておく。
+ */
+constexpr uint_fast16_t Rotate(uint_fast16_t data, int rotate) {
+  if (rotate == 0) {
+    return data;
+  } else if (rotate == 1) {
+    return (data >> 4) | ((data & 0b1111) << 12);
+  } else if (rotate == 2) {
+    return (data >> 8) | ((data & 0b11111111) << 8);
+  } else {
+    return ((data << 4) | (data >> 12)) & 0xFFFF;
+  }
+}
 
+constexpr uint_fast16_t TopLine(uint_fast16_t data) {
+  return (data >> 8);
 }
 
+constexpr uint_fast16_t BottomLine(uint_fast16_t data) {
+  return (((data >> 4) & 0b1111) | ((data << 4) & 0b11110000));
+}
 
-void Pack::Init() {
-  memset(flammable_patterns, 0, sizeof(flammable_patterns));
-  memset(number_count_table, 0, sizeof(number_count_table));
+/**
+ * 1列に、上にtop、下にbottomのブロックを置いて落とした後の、その列に積まれたブロックの並び
+ * 下から順に4bitずつ並べ、ブロックがない場合は0となる。
+ */
+constexpr int GetColumnPattern(int top, int bottom) {
+  if (bottom == 0) {
+    return top << 4;
+  }
+  return (bottom << 4) | top;
+}
+
+/**
+ * Pack::GetUniqueActions()を、表を使わずに計算する。
+ *
+ * 落とした後の局面を (ブロックのある最も左の列, その列の並び, 右隣の列の並び) で表すと、
+ * 回転ごとに、最も左の列は置いた列から0列か1列右にずれ、並びは置いた列によらない。
+ * そのため、同じ局面になる行動の組は、回転の組ごとに、置いた列の差が決まったものに限られる。
+ * 回転の組ごとに、その差だけ行動のbitをずらして重ねることで、番号の小さい行動と重なるものを除く。
+ */
+constexpr uint64_t CalculateUniqueActions(uint_fast16_t data, uint64_t candidates) {
+  candidates &= Pack::kALL_ACTIONS;
+
+  // ブロックがないpackは、どこに置いても同じ
+  if (data == 0) {
+    return candidates & (~candidates + 1);
+  }
+
+  int offsets[4] = { };  // ブロックのある最も左の列の、置いた列からのずれ
+  int patterns[4] = { };  // その列と右隣の列の並び
+
+  for (int rotate = 0; rotate < 4; rotate++) {
+    const uint_fast16_t rotated = Rotate(data, rotate);
+    int left = GetColumnPattern(TopLine(rotated) >> 4, BottomLine(rotated) >> 4);
+    int right = GetColumnPattern(TopLine(rotated) & 0b1111, BottomLine(rotated) & 0b1111);
+
+    if (left != 0) {
+      offsets[rotate] = 0;
+      patterns[rotate] = (left << 8) | right;
+    } else {
+      offsets[rotate] = 1;
+      patterns[rotate] = right << 8;
+    }
+  }
+
+  uint64_t rotation_masks[4] = { };  // 回転ごとの、全ての列の行動
+  for (int column = 0; column < 9; column++) {
+    for (int rotate = 0; rotate < 4; rotate++) {
+      rotation_masks[rotate] |= (1ULL << (column * 4 + rotate));
+    }
+  }
+
+  uint64_t duplicates = 0;
+  for (int rotate = 0; rotate < 4; rotate++) {
+    for (int other = 0; other < 4; other++) {
+      if (other == rotate || patterns[other] != patterns[rotate]) {
+        continue;
+      }
+
+      // column列目にrotate回転で置く行動は、column + offsets[rotate] - offsets[other]列目にother回転で置く行動と同じ局面になる
+      // 行動の番号の差がshiftで、番号の小さい行動が候補にあれば除く
+      const int shift = 4 * (offsets[other] - offsets[rotate]) + (rotate - other);
+      if (shift > 0) {
+        duplicates |= ((candidates & rotation_masks[other]) << shift) & rotation_masks[rotate];
+      }
+    }
+  }
+
+  return candidates & ~duplicates;
+}
+
+/**
+ * 4つのブロックの数字 (0から9) を10進数として並べた番号
+ * 使われない16bitの値を詰めて、表を小さくするために用いる。
+ */
+constexpr int GetDecimalIndex(uint_fast16_t data) {
+  return (((data >> 12) * 10 + ((data >> 8) & 0b1111)) * 10 + ((data >> 4) & 0b1111)) * 10 + (data & 0b1111);
+}
 
-  // それぞれの数字があるPackに何個含まれるかを，表に格納しておく
+const int kDECIMAL_INDEX_NUM = 10000;
+
+struct UniqueActionTable {
+  uint64_t actions[kDECIMAL_INDEX_NUM];  // actions[GetDecimalIndex(data)]: 全ての行動に対するGetUniqueActions()
+};
+
+constexpr UniqueActionTable MakeUniqueActionTable() {
+  UniqueActionTable table = { };
   for (int num1 = 0; num1 < 10; num1++) {
     for (int num2 = 0; num2 < 10; num2++) {
       for (int num3 = 0; num3 < 10; num3++) {
         for (int num4 = 0; num4 < 10; num4++) {
-          int bit_pattern = (num1 << 12) | (num2 << 8) | (num3 << 4) | num4;
-          if (num1 + num2 == 10 || num1 + num3 == 10 || num1 + num4 == 10 || num2 + num3 == 10 || num2 + num4 == 10 || num3 + num4 == 10) {
-            flammable_patterns[bit_pattern] = true;
-          }
-
-          number_count_table[num1][bit_pattern]++;
-          number_count_table[num2][bit_pattern]++;
-          number_count_table[num3][bit_pattern]++;
-          number_count_table[num4][bit_pattern]++;
+          const uint_fast16_t data = (num1 << 12) | (num2 << 8) | (num3 << 4) | num4;
+          table.actions[GetDecimalIndex(data)] = CalculateUniqueActions(data, Pack::kALL_ACTIONS);
         }
       }
     }
   }
+  return table;
+}
+
+// 落とした後の局面が異なる行動のみを残したもの (コンパイル時に計算する)
+constexpr UniqueActionTable unique_action_table = MakeUniqueActionTable();
+
+}
+
+
+void Pack::Init() {
+  // 表は全てコンパイル時に作る (呼び出し側のために残している)
 }
 
 
@@ -63,32 +165,22 @@ void Pack::Set(int upper_left, int upper_right, int lower_left, int lower_right)
 
 Pack Pack::GetRotated(int rotate) const {
   assert(0 <= rotate && rotate < 4);
-
-  if (rotate == 0) {
-    return Pack(data_);
-  } else if (rotate == 1) {
-    return Pack((data_ >> 4) | ((data_ & 0b1111) << 12));
-  } else if (rotate == 2) {
-    return Pack((data_ >> 8) | ((data_ & 0b11111111) << 8));
-  } else {
-    return Pack(((data_ << 4) | (data_ >> 12)) & 0xFFFF);
-  }
+  return Pack(Rotate(data_, rotate));
 }
 
 uint_fast16_t Pack::GetTopLine() const {
-  return (data_ >> 8);
+  return TopLine(data_);
 }
 
 uint_fast16_t Pack::GetBottomLine() const {
-  return (((data_ >> 4) & 0b1111) | ((data_ << 4) & 0b11110000));
+  return BottomLine(data_);
 }
 
-bool Pack::IsFlammable() const {
-  return flammable_patterns[data_];
-}
-
-int Pack::Count(int number) const {
-  return number_count_table[number][data_];
+uint64_t Pack::GetUniqueActions(uint64_t candidates) const {
+  if (candidates == kALL_ACTIONS) {
+    return unique_action_table.actions[GetDecimalIndex(data_)];
+  }
+  return CalculateUniqueActions(data_, candidates);
 }
 
 bool Pack::operator==(const Pack& pack) const {
@@ -17,11 +17,16 @@ private:
   uint_fast16_t data_;
 
 public:
+  static inline const uint64_t kALL_ACTIONS = (1ULL << 36) - 1;  // 36通りの行動全て (column * 4 + rotate番目のbitで表す)
+
   Pack() = default;
   Pack(uint_fast16_t data_);
   Pack(int upper_left, int upper_right, int lower_left, int lower_right);
 
 
+  /**
+   * 表は全てコンパイル時に作るので、何もしない。
+   */
   static void Init();
 
   void GetInput();
@@ -31,9 +36,33 @@ public:
   uint_fast16_t GetTopLine() const;  // 上段のブロックたちを得る
   uint_fast16_t GetBottomLine() const; // 下段のブロックたちを得る
 
-  bool IsFlammable() const;  // このPackを何もないところに落とすだけで、1連鎖が発生するかどうか
+  /**
+   * このPackを何もないところに落とすだけで、1連鎖が発生するかどうか
+   * いずれか2つのブロックの和が10になるかどうかを、表を使わずに調べる。
+   */
+  constexpr bool IsFlammable() const {
+    const int a = data_ >> 12, b = (data_ >> 8) & 0b1111, c = (data_ >> 4) & 0b1111, d = data_ & 0b1111;
+    return a + b == 10 || a + c == 10 || a + d == 10 || b + c == 10 || b + d == 10 || c + d == 10;
+  }
+
+  /**
+   * numberが何個含まれているかを返す
+   * numberと等しい4bitが0となるようにxorを取り、0でない4bitの数を数える。
+   */
+  constexpr int Count(int number) const {
+    uint_fast16_t x = data_ ^ (number * 0x1111);
+    x |= x >> 1;
+    x |= x >> 2;
+    return 4 - __builtin_popcount(x & 0x1111);
+  }
 
-  int Count(int number) const;  // numberが何個含まれているかを返す
+  /**
+   * candidatesに含まれる行動 (column * 4 + rotate番目のbit) のうち、
+   * 落とした後の局面が、candidatesに含まれるより番号の小さい行動と同じになるものを除いて返す。
+   * 0が含まれる、同じ数字が含まれるなどで、回転しても落とした後の局面が変わらない場合がある。
+   * 結果は盤面によらずpackのみで決まり、全ての行動に対する結果はコンパイル時に表にしておく。
+   */
+  uint64_t GetUniqueActions(uint64_t candidates = kALL_ACTIONS) const;
 
   bool operator==(const Pack& pack) const;
   std::string ToString() const;
@@ -1,6 +1,9 @@
 #include "position.h"
 #include "types.h"
+#include "bitboard.h"
+#include "stats.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <cmath>
@@ -10,11 +13,18 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <random>
 #include <immintrin.h>
 
 namespace {
 
 
+const PackedCells kLINE_PAIR_MASK = 0xFFFFFFFFFULL;  // 横の組の右側のnibble (0から8番目)
+const PackedCells kLINE_MASK = 0xFFFFFFFFFFULL;
+
+const int kHASH_BYTES = (4 * kWIDTH + 7) / 8;  // 1行を何byteに区切ってハッシュを計算するか
+uint64_t zobrist_table[kDANGER_HEIGHT][kHASH_BYTES][256];  // zobrist_table[y][i][v]: y行目のi番目のbyteがvのときの乱数
+
 bool line_disappear_mask[0b11111111];  // 隣接横2ブロックが消えるかどうかのマスク
 PackedCells other_disappear_mask[0b1111][0b111111111111];  // 左上、上、右上のマスク
 const int chain_scores[64] = {
@@ -36,6 +46,18 @@ void Position::Init() {
    * ビット演算で行えるようにしておく。
    */
 
+  // ハッシュ用の乱数表
+  // 空の部分は0としておくことで、空の行を計算から省けるようにする
+  std::mt19937_64 engine(20190421);
+  for (int y = 0; y < kDANGER_HEIGHT; y++) {
+    for (int i = 0; i < kHASH_BYTES; i++) {
+      zobrist_table[y][i][0] = 0;
+      for (int v = 1; v < 256; v++) {
+        zobrist_table[y][i][v] = engine();
+      }
+    }
+  }
+
   // 左上、上、右上、右（とその対称）について調べておけば、それが全て
   memset(line_disappear_mask, 0, sizeof(line_disappear_mask));
   memset(other_disappear_mask, 0, sizeof(other_disappear_mask));
@@ -86,6 +108,7 @@ void Position::Init() {
 
 Position::Position() {
   memset(cells, 0, sizeof(cells));
+  memset(heights, 0, sizeof(heights));
 }
 
 void Position::Print() const {
@@ -110,6 +133,14 @@ void Position::GetInput() {
     cells[y] = data_;
   }
 
+  for (int x = 0; x < kWIDTH; x++) {
+    int y = 0;
+    while (y < kDANGER_HEIGHT && Get(y, x) == 0) {
+      y++;
+    }
+    heights[x] = kDANGER_HEIGHT - y;
+  }
+
   std::string end_str;
   std::cin >> end_str;
   assert(end_str == "END");
@@ -135,9 +166,43 @@ void Position::Set(int y, int x, uint_fast64_t cell) {
   uint_fast64_t bitmask = ~(0b1111ULL << shift);
   cells[y] &= bitmask;  // 対象のcellを0にする
   cells[y] |= (cell << shift);  // 対象のcellに値を設定
+
+  // 高さを更新する
+  if (cell != 0 && y < kDANGER_HEIGHT - heights[x]) {
+    heights[x] = kDANGER_HEIGHT - y;
+  } else if (cell == 0 && y == kDANGER_HEIGHT - heights[x]) {
+    int top_y = y + 1;
+    while (top_y < kDANGER_HEIGHT && Get(top_y, x) == 0) {
+      top_y++;
+    }
+    heights[x] = kDANGER_HEIGHT - top_y;
+  }
+}
+
+int Position::GetHeight(int x) const {
+  return heights[x];
+}
+
+int Position::GetMaxHeight() const {
+  int max_height = 0;
+  for (int x = 0; x < kWIDTH; x++) {
+    max_height = std::max(max_height, (int)heights[x]);
+  }
+  return max_height;
 }
 
 Score Position::Simulate(const Pack& pack, const Action& action) {
+  Stats::Add(Stats::SIMULATE_COUNT);
+
+#ifdef BITBOARD
+  // bitplane表現に変換して計算する
+  Bitboard bitboard(*this);
+  Score bitboard_score = bitboard.Simulate(pack, action);
+  bitboard.Store(this);
+  Stats::Add(Stats::CHAIN_ITERATION_COUNT, bitboard_score.chain_count + 1);
+  return bitboard_score;
+#endif
+
   // デバッグ用 現在の状態を保存しておく
   // Position start_position = *this;
 
@@ -204,119 +269,243 @@ Score Position::Simulate(const Pack& pack, const Action& action) {
     cells[1] |= (rotate_pack.GetBottomLine() << (4 * (kWIDTH - 2 - action.column)));
   }
 
+  /**
+   * 連鎖の計算は、前回から変化した部分だけを調べる。
+   *  - 落下処理は、ブロックが消えた列 (dirty_columns) だけを、消えた最も下の行から詰める。
+   *  - 消去判定は、前回の判定から動いたブロック (changed_cells) を含む組だけを調べる。
+   *    動いていないブロック同士の組は、前回の判定で消えなかったのでもう消えることはない。
+   * NORMAL, SKILLは、元の局面が安定している (落ちるブロックも消えるブロックもない) ことを仮定する。
+   */
+  int ground_ys[kWIDTH];  // ground_ys[x]: x列目で、この行から上に空いている升を探す (この行より下は詰まっている)
+  for (int x = 0; x < kWIDTH; x++) {
+    ground_ys[x] = kDANGER_HEIGHT - 1;
+  }
+
+  unsigned dirty_columns = 0;
+  PackedCells changed_cells[kDANGER_HEIGHT] = { };
+  int changed_top = kDANGER_HEIGHT;
+  int changed_bottom = -1;
+
+  if (action.action_type == NORMAL) {
+    // 置いた2列は、元の高さのすぐ上から詰めればよい
+    dirty_columns = (0b11U << action.column);
+    ground_ys[action.column] = kDANGER_HEIGHT - 1 - heights[action.column];
+    ground_ys[action.column + 1] = kDANGER_HEIGHT - 1 - heights[action.column + 1];
+    changed_cells[0] = changed_cells[1] = (0xFFULL << (4 * (kWIDTH - 2 - action.column)));
+    changed_top = 0;
+    changed_bottom = 1;
+  } else if (action.action_type == SKILL) {
+    for (int x = 0; x < kWIDTH; x++) {
+      dirty_columns |= (1U << x);
+    }
+  } else {
+    // 局面が安定しているとは限らないので、全体を調べる
+    for (int x = 0; x < kWIDTH; x++) {
+      dirty_columns |= (1U << x);
+    }
+    for (int y = 0; y < kDANGER_HEIGHT; y++) {
+      changed_cells[y] = kLINE_MASK;
+    }
+    changed_top = 0;
+    changed_bottom = kDANGER_HEIGHT - 1;
+  }
+
+  const int chains = Chain(dirty_columns, ground_ys, changed_cells, changed_top, changed_bottom);
+
+  score.chain_score = chain_scores[chains];
+  score.chain_count = chains;
+  return score;
+}
+
+Score Position::SimulateErase(int y, int x) {
+  Stats::Add(Stats::SIMULATE_COUNT);
+
+#ifdef BITBOARD
+  Bitboard bitboard(*this);
+  bitboard.Set(y, x, 0);
+  Score bitboard_score = bitboard.Simulate(Pack(), Action(NO_ACTION_TYPE));
+  bitboard.Store(this);
+  Stats::Add(Stats::CHAIN_ITERATION_COUNT, bitboard_score.chain_count + 1);
+  return bitboard_score;
+#endif
+
+  cells[y] &= ~(0xFULL << (4 * (kWIDTH - 1 - x)));
+
+  // 消した升の上にあるブロックだけが落ちるので、x列目をy行目から詰める
+  // 動いたブロックは、落下処理の中でchanged_cellsに記録される
+  int ground_ys[kWIDTH];
+  for (int i = 0; i < kWIDTH; i++) {
+    ground_ys[i] = kDANGER_HEIGHT - 1;
+  }
+  ground_ys[x] = y;
+
+  PackedCells changed_cells[kDANGER_HEIGHT] = { };
+  const int chains = Chain(1U << x, ground_ys, changed_cells, kDANGER_HEIGHT, -1);
+
+  Score score;
+  score.chain_score = chain_scores[chains];
+  score.chain_count = chains;
+  return score;
+}
+
+int Position::Chain(unsigned dirty_columns, int ground_ys[kWIDTH], PackedCells changed_cells[kDANGER_HEIGHT], int changed_top, int changed_bottom) {
+  int top_y = 0;  // これより上の行は空
+  PackedCells disappear_cells[kDANGER_HEIGHT] = { };
+
   int chains = 0;
   while (true) {
     bool update = false;
 
     // ブロックを落とす
-    {
-      PackedCells disappear_cells[kDANGER_HEIGHT] = { };
-      PackedCells appear_cells[kDANGER_HEIGHT] = { };
+    while (top_y < kDANGER_HEIGHT && cells[top_y] == 0ULL) {
+      top_y++;
+    }
 
-      for (int x = 0; x < kWIDTH; x++) {
-        // 下から探して、一番初めに空であるy座標を探す
-        int ground_y = kDANGER_HEIGHT - 1;
-        for (; ground_y >= 0; ground_y--) {
-          int shift = 4 * (kWIDTH - 1 - x);
-          PackedCells target_cell = (cells[ground_y] & (0b1111ULL << shift));
-          if (target_cell == 0) {
-            break;
-          }
-        }
+    for (; dirty_columns != 0; dirty_columns &= dirty_columns - 1) {
+      const int x = __builtin_ctz(dirty_columns);
+      const int shift = 4 * (kWIDTH - 1 - x);
+      const PackedCells column_mask = (0xFULL << shift);
 
-        // ground_yより上にある数字たちを集める
-        int count = 0;
-        for (int y = ground_y - 1; y >= 0; y--) {
-          int shift = 4 * (kWIDTH - 1 - x);
-          PackedCells target_cell = (cells[y] & (0b1111ULL << shift));
-          if (target_cell != 0ULL) {
-            disappear_cells[y] |= target_cell;
-            appear_cells[ground_y - count] |= target_cell;
-            count++;
-          }
+      // 下から探して、一番初めに空であるy座標を探す
+      int ground_y = ground_ys[x];
+      for (; ground_y >= top_y; ground_y--) {
+        if ((cells[ground_y] & column_mask) == 0ULL) {
+          break;
+        }
+      }
+      ground_ys[x] = kDANGER_HEIGHT - 1;
+
+      // ground_yより上にある数字たちを詰める
+      int count = 0;
+      for (int y = ground_y - 1; y >= top_y; y--) {
+        PackedCells target_cell = (cells[y] & column_mask);
+        if (target_cell != 0ULL) {
+          cells[y] ^= target_cell;
+          cells[ground_y - count] |= target_cell;
+          changed_cells[ground_y - count] |= column_mask;
+          count++;
         }
       }
 
-      for (int y = 0; y < kDANGER_HEIGHT; y++) {
-        // ブロックの移動 = ブロックの消去＋ブロックの出現
-        cells[y] ^= disappear_cells[y];
-        cells[y] |= appear_cells[y];
+      heights[x] = kDANGER_HEIGHT - 1 - ground_y + count;
+
+      if (count > 0) {
+        changed_top = std::min(changed_top, ground_y - count + 1);
+        changed_bottom = std::max(changed_bottom, ground_y);
       }
     }
 
     // 消えるブロックを消す
-    {
-      PackedCells disappear_cells[kDANGER_HEIGHT] = { };
-      for (int y = kDANGER_HEIGHT - 1; y > 0; y--) {
-        if (cells[y] == 0ULL) {
-          continue;
-        }
+    const int check_top = std::max(1, changed_top);
+    const int check_bottom = std::min(kDANGER_HEIGHT - 1, changed_bottom + 1);
+    for (int y = check_bottom; y >= check_top; y--) {
+      if (cells[y] == 0ULL) {
+        continue;
+      }
 
-        // 1行内で消える場合
-        for (int x = 8; x >= 0; x--) {
-          // 下位8bitを取り出す
-          PackedCells mask = cells[y] & (0b11111111ULL << (4 * x));
-          if (line_disappear_mask[mask >> (4 * x)]) {
-            update = true;
-            disappear_cells[y] |= mask;
-          }
+      // 1行内で消える場合
+      const PackedCells changed = changed_cells[y];
+      for (PackedCells targets = (changed | (changed >> 4)) & kLINE_PAIR_MASK; targets != 0ULL; ) {
+        const int x = __builtin_ctzll(targets) / 4;
+        targets &= ~(0xFULL << (4 * x));
+
+        // 下位8bitを取り出す
+        PackedCells mask = cells[y] & (0b11111111ULL << (4 * x));
+        if (line_disappear_mask[mask >> (4 * x)]) {
+          update = true;
+          disappear_cells[y] |= mask;
         }
+      }
 
-        // 2行内で消える場合
-        if (cells[y - 1] == 0ULL) {
-          continue;
-        }
+      // 2行内で消える場合
+      if (cells[y - 1] == 0ULL) {
+        continue;
+      }
 
-        for (int x = 9; x >= 0; x--) {
-          // 引いてくる表のインデックス
-          PackedCells mask = cells[y] & (0xFULL << (4 * x));
-          PackedCells mask2 = cells[y - 1] & ((x > 0)? (0xFFFULL << (4 * (x - 1))) : 0xFFULL);
-
-          /**
-           * デバッグ用
-           * もう一度同じ条件で関数を呼び、デバッグをしやすくする。
-           * もちろん無限ループになるので、gdbなどの使用を想定。
-          if (something strange) {                         (e.g. if (((mask >> (4 * x)) >= 0b1111)) )
-            std::cerr << "----- PANIC -----" << std::endl;
-            start_position.Simulate(pack, action);
-          }
-          */
-
-          // 消える対象のブロックは、この配列に前計算してある
-          PackedCells result = other_disappear_mask[mask >> (4 * x)][(x > 0)? (mask2 >> (4 * (x - 1))) : (mask2 << 4)];
-
-          if (result != 0ULL) {
-            update = true;
-            disappear_cells[y] |= mask;
-            if (x == 0) {
-              disappear_cells[y - 1] |= (result >> 4);
-            } else {
-              disappear_cells[y - 1] |= result << (4 * (x - 1));
-            }
+      const PackedCells changed_above = changed_cells[y - 1];
+      PackedCells targets = (changed | changed_above | (changed_above << 4) | (changed_above >> 4)) & kLINE_MASK;
+      for (; targets != 0ULL; ) {
+        const int x = __builtin_ctzll(targets) / 4;
+        targets &= ~(0xFULL << (4 * x));
+
+        // 引いてくる表のインデックス
+        PackedCells mask = cells[y] & (0xFULL << (4 * x));
+        PackedCells mask2 = cells[y - 1] & ((x > 0)? (0xFFFULL << (4 * (x - 1))) : 0xFFULL);
+
+        /**
+         * デバッグ用
+         * もう一度同じ条件で関数を呼び、デバッグをしやすくする。
+         * もちろん無限ループになるので、gdbなどの使用を想定。
+        if (something strange) {                         (e.g. if (((mask >> (4 * x)) >= 0b1111)) )
+          std::cerr << "----- PANIC -----" << std::endl;
+          start_position.Simulate(pack, action);
+        }
+        */
+
+        // 消える対象のブロックは、この配列に前計算してある
+        PackedCells result = other_disappear_mask[mask >> (4 * x)][(x > 0)? (mask2 >> (4 * (x - 1))) : (mask2 << 4)];
+
+        if (result != 0ULL) {
+          update = true;
+          disappear_cells[y] |= mask;
+          if (x == 0) {
+            disappear_cells[y - 1] |= (result >> 4);
+          } else {
+            disappear_cells[y - 1] |= result << (4 * (x - 1));
           }
         }
       }
+    }
 
-      for (int y = kDANGER_HEIGHT - 1; y > 0; y--) {
-        // 行ごとに消えるブロックたちがdisappear_cellsに集まっているので、
-        // xorを取ることでブロックを消去する
-        cells[y] ^= disappear_cells[y];
-      }
+    for (int y = std::max(0, changed_top); y <= changed_bottom; y++) {
+      changed_cells[y] = 0ULL;
     }
+    changed_top = kDANGER_HEIGHT;
+    changed_bottom = -1;
 
     if (!update) {
       // 消えたブロックがなければ、連鎖終了
       break;
     }
 
+    // 行ごとに消えるブロックたちがdisappear_cellsに集まっているので、
+    // xorを取ることでブロックを消去する
+    // 消えたブロックのうち各列で最も下にあるものから、次の落下処理を始める
+    PackedCells found = 0ULL;
+    for (int y = check_bottom; y >= check_top - 1; y--) {
+      if (y > 0) {
+        cells[y] ^= disappear_cells[y];
+
+        for (PackedCells bits = disappear_cells[y] & ~found; bits != 0ULL; ) {
+          const int n = __builtin_ctzll(bits) / 4;
+          const int x = kWIDTH - 1 - n;
+          bits &= ~(0xFULL << (4 * n));
+          found |= (0xFULL << (4 * n));
+          dirty_columns |= (1U << x);
+          ground_ys[x] = y;
+        }
+      }
+      disappear_cells[y] = 0ULL;
+    }
+
     chains++;
   }
 
-  score.chain_score = chain_scores[chains];
-  score.chain_count = chains;
-  return score;
+  Stats::Add(Stats::CHAIN_ITERATION_COUNT, chains + 1);
+  return chains;
+}
+
+void Position::SimulateBatch(Position positions[], const Pack packs[], const Action actions[], Score scores[], int n) {
+  Stats::Add(Stats::SIMULATE_COUNT, n);
+  Bitboard::SimulateBatch(positions, packs, actions, scores, n);
+  for (int i = 0; i < n; i++) {
+    Stats::Add(Stats::CHAIN_ITERATION_COUNT, scores[i].chain_count + 1);
+  }
 }
 
+int Position::GetChainScore(int chain_count) {
+  return chain_scores[chain_count];
+}
 
 bool Position::IsGameOver() const {
   return (cells[2] > 0ULL);
@@ -337,6 +526,20 @@ void Position::Attacked(int attack_num) {
   Simulate(Pack(), Action(NO_ACTION_TYPE));
 }
 
+uint64_t Position::Hash() const {
+  uint64_t hash = 0;
+
+  for (int y = 0; y < kDANGER_HEIGHT; y++) {
+    PackedCells row = cells[y];
+    for (int i = 0; row != 0ULL; i++) {
+      hash ^= zobrist_table[y][i][row & 0xFFULL];
+      row >>= 8;
+    }
+  }
+
+  return hash;
+}
+
 bool Position::operator==(const Position& position) const {
   for (int y = 0; y < kDANGER_HEIGHT; y++) {
     if (position.cells[y] != cells[y]) {
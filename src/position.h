@@ -22,6 +22,21 @@ private:
    */
   PackedCells cells[kDANGER_HEIGHT];
 
+  /**
+   * heights[x]は、x列目の高さ (一番上のブロックが下から何段目にあるか) を表す。
+   * ブロックを落とす、消す、お邪魔を降らせるたびに更新し、毎回盤面を走査しなくてよいようにする。
+   */
+  uint8_t heights[kWIDTH];
+
+  friend class Bitboard;
+
+  /**
+   * 落下と消去を、消えるブロックがなくなるまで繰り返し、連鎖数を返す。
+   * dirty_columnsの列はground_ys[x]行目から上を詰め、消去判定はchanged_cellsの升を含む組だけを調べる。
+   * changed_cellsのうち、changed_top行目からchanged_bottom行目以外は0であること。
+   */
+  int Chain(unsigned dirty_columns, int ground_ys[kWIDTH], PackedCells changed_cells[kDANGER_HEIGHT], int changed_top, int changed_bottom);
+
 public:
   Position();
 
@@ -54,17 +69,55 @@ public:
 
   /**
    * cells[y][x]にcellを設定する。
+   * 浮いたブロックができる場合があるので、Simulate(Pack(), Action(NO_ACTION_TYPE))で落としてから使うこと。
    */
   void Set(int y, int x, uint_fast64_t cell);
 
+  /**
+   * x列目の高さを取得する。
+   * (y, x)にブロックがあることと、y >= kDANGER_HEIGHT - GetHeight(x)は同値である。
+   */
+  int GetHeight(int x) const;
+
+  /**
+   * 最も高い列の高さを取得する。
+   * cells[y]にブロックがあることと、y >= kDANGER_HEIGHT - GetMaxHeight()は同値である。
+   */
+  int GetMaxHeight() const;
+
   /**
    * PackをActionで指定された状態で落とす。
    * お邪魔がある場合には、あらかじめpackに詰めておくこと。
    */
   Score Simulate(const Pack& pack, const Action& action);
 
+  /**
+   * (y, x)のブロックを消し、上のブロックを落として連鎖させる。
+   * 局面が安定している場合、Set(y, x, 0)の後にSimulate(Pack(), Action(NO_ACTION_TYPE))を呼んだ場合と一致する。
+   * 落ちる列と動いたブロックの周りだけを調べるので、Simulate()で全体を調べるより速い。
+   */
+  Score SimulateErase(int y, int x);
+
+  /**
+   * n個の局面positions[i]に、packs[i]をactions[i]で落とす処理をまとめて行い、得点をscores[i]に格納する。
+   * 結果はそれぞれSimulate()を呼んだ場合と一致する。
+   */
+  static void SimulateBatch(Position positions[], const Pack packs[], const Action actions[], Score scores[], int n);
+
   bool IsGameOver() const;
 
+  /**
+   * chain_count連鎖の得点を返す。
+   */
+  static int GetChainScore(int chain_count);
+
+  /**
+   * 局面のハッシュ値を返す。
+   * 各行を8bitごとに区切り、(行, 区切り, 値)ごとの乱数のxorを取る (Zobrist hashing)。
+   * 空の行は計算を省くため、ブロックの少ない局面ほど高速に計算できる。
+   */
+  uint64_t Hash() const;
+
   /**
    * お邪魔ブロックの落下処理。
    */
@@ -0,0 +1,492 @@
+/**
+ * 対戦サーバの代わりに、2つの思考プログラムを標準入出力で対戦させる。
+ *
+ * 使い方:
+ *   ./referee/referee [--white CMD] [--black CMD] [--games N] [--parallel P] [--seed S] [--record DIR] [--stderr DIR]
+ *
+ * CMDは/bin/sh -cで実行する (既定は "./codevs --threads 1")。
+ * N試合をP試合ずつ同時に行い、試合ごとの結果と勝敗の集計を表示する。
+ * 試合ごとにseed + 試合番号を乱数の種としてPackを生成するので、同じ種からは同じ試合が再現する。
+ * --recordを与えると、WHITEに送った入力をDIR/match_<試合番号>.logに保存する (bench/replayでそのまま再生できる)。
+ *
+ * ルール:
+ *  - お邪魔ストックが10以上ある場合、行動の前にお邪魔ブロックが1段降る
+ *  - 連鎖またはスキルで得た得点の半分だけ、まず自分のお邪魔ストックを相殺し、残りを相手に送る
+ *  - 連鎖をするとスキルゲージが8増え (最大100)、3連鎖以上では相手のスキルゲージを12 + 2 * 連鎖数だけ減らす
+ *  - スキルはゲージが80以上のときに使え、使うとゲージは0になる
+ *  - デンジャーラインを超える、不正な行動をする、持ち時間を使い切る、のいずれかで負け
+ */
+
+#include "../action.h"
+#include "../pack.h"
+#include "../position.h"
+#include "../score.h"
+#include "../types.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+const int kINITIAL_TIME = 180 * 1000;  // 持ち時間 (ミリ秒)
+const int kNAME_TIMEOUT = 30 * 1000;  // 名前の出力を待つ時間 (ミリ秒、持ち時間には含めない)
+const int kSKILL_GAUGE_MAX = 100;
+const int kSKILL_GAUGE_REQUIRED = 80;
+
+struct Options {
+  std::string commands[COLOR_NB] = { "./codevs --threads 1", "./codevs --threads 1" };
+  int games = 1;
+  int parallel = 1;
+  unsigned seed = 1;
+  std::string record_dir;  // 空の場合は記録しない
+  std::string stderr_dir;  // 空の場合は思考プログラムの標準エラー出力を捨てる
+};
+
+/**
+ * 標準入出力をパイプでつないだ思考プログラム
+ */
+class Engine {
+private:
+  pid_t pid;
+  int write_fd;  // 思考プログラムの標準入力
+  int read_fd;  // 思考プログラムの標準出力
+  std::string buffer;  // 読み込んだが、まだ行として取り出していない文字列
+
+public:
+  Engine(): pid(-1), write_fd(-1), read_fd(-1) { }
+  Engine(const Engine&) = delete;
+  Engine& operator=(const Engine&) = delete;
+  ~Engine() { Stop(); }
+
+  bool Start(const std::string& command, const std::string& stderr_path);
+  void Stop();
+
+  bool Send(const std::string& text);
+
+  /**
+   * 1行読み込む。
+   * timeout_msミリ秒以内に1行揃わない場合や、プログラムが終了した場合はfalseを返す。
+   */
+  bool ReadLine(std::string* line, int timeout_ms);
+};
+
+bool Engine::Start(const std::string& command, const std::string& stderr_path) {
+  int to_child[2], from_child[2];
+  if (pipe(to_child) != 0 || pipe(from_child) != 0) {
+    return false;
+  }
+
+  pid = fork();
+  if (pid < 0) {
+    return false;
+  }
+
+  if (pid == 0) {
+    dup2(to_child[0], STDIN_FILENO);
+    dup2(from_child[1], STDOUT_FILENO);
+    int err_fd = open(stderr_path.empty()? "/dev/null" : stderr_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (err_fd >= 0) {
+      dup2(err_fd, STDERR_FILENO);
+      close(err_fd);
+    }
+    close(to_child[0]);
+    close(to_child[1]);
+    close(from_child[0]);
+    close(from_child[1]);
+
+    execl("/bin/sh", "sh", "-c", command.c_str(), (char*)nullptr);
+    _exit(127);
+  }
+
+  close(to_child[0]);
+  close(from_child[1]);
+  write_fd = to_child[1];
+  read_fd = from_child[0];
+  return true;
+}
+
+void Engine::Stop() {
+  if (write_fd >= 0) {
+    close(write_fd);
+    write_fd = -1;
+  }
+  if (read_fd >= 0) {
+    close(read_fd);
+    read_fd = -1;
+  }
+
+  // 入力が終わっても待ち続けるので、強制的に終了させる
+  if (pid > 0) {
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    pid = -1;
+  }
+}
+
+bool Engine::Send(const std::string& text) {
+  size_t written = 0;
+  while (written < text.size()) {
+    ssize_t n = write(write_fd, text.data() + written, text.size() - written);
+    if (n <= 0) {
+      return false;
+    }
+    written += n;
+  }
+  return true;
+}
+
+bool Engine::ReadLine(std::string* line, int timeout_ms) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+  while (true) {
+    size_t newline = buffer.find('\n');
+    if (newline != std::string::npos) {
+      *line = buffer.substr(0, newline);
+      buffer.erase(0, newline + 1);
+      if (!line->empty() && line->back() == '\r') {
+        line->pop_back();
+      }
+      return true;
+    }
+
+    int rest = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (rest <= 0) {
+      return false;
+    }
+
+    pollfd fds = { read_fd, POLLIN, 0 };
+    if (poll(&fds, 1, rest) <= 0) {
+      return false;
+    }
+
+    char chunk[256];
+    ssize_t n = read(read_fd, chunk, sizeof(chunk));
+    if (n <= 0) {
+      return false;
+    }
+    buffer.append(chunk, n);
+  }
+}
+
+struct Player {
+  Position position;
+  int remain_time = kINITIAL_TIME;
+  int ojama_stock = 0;
+  int skill = 0;
+  int score = 0;
+};
+
+struct MatchResult {
+  int index;
+  int winner;  // WHITE, BLACK, または引き分けの場合は-1
+  int turn;  // 決着したターン
+  int scores[COLOR_NB];
+  std::string reason;
+};
+
+/**
+ * Packを生成する。
+ * 各ブロックは1から9で、半分の確率でいずれか1つを空きにする。
+ */
+void GeneratePacks(unsigned seed, int values[kTURN_MAX][4]) {
+  std::mt19937 engine(seed);
+  for (int t = 0; t < kTURN_MAX; t++) {
+    for (int i = 0; i < 4; i++) {
+      values[t][i] = 1 + engine() % 9;
+    }
+    if (engine() % 2 == 0) {
+      values[t][engine() % 4] = 0;
+    }
+  }
+}
+
+/**
+ * colorから見たターン開始時の入力を作る。
+ */
+std::string MakeTurnInput(int turn, const Player players[COLOR_NB], Color color) {
+  std::ostringstream os;
+  os << turn << "\n";
+  for (Color c : { color, (Color)(1 - color) }) {
+    const Player& player = players[c];
+    os << player.remain_time << " " << player.ojama_stock << " " << player.skill << " " << player.score << "\n";
+    for (int y = kDANGER_HEIGHT - kHEIGHT; y < kDANGER_HEIGHT; y++) {
+      for (int x = 0; x < kWIDTH; x++) {
+        os << ((x == 0)? "" : " ") << player.position.Get(y, x);
+      }
+      os << "\n";
+    }
+    os << "END\n";
+  }
+  return os.str();
+}
+
+/**
+ * 行動を解釈する。
+ * 不正な形式の場合はfalseを返す。
+ */
+bool ParseAction(const std::string& line, Action* action) {
+  if (line == "S") {
+    *action = Action(SKILL);
+    return true;
+  }
+
+  int column = -1, rotate = -1;
+  char rest = '\0';
+  if (sscanf(line.c_str(), "%d %d %c", &column, &rotate, &rest) != 2) {
+    return false;
+  }
+  if (column < 0 || column >= kWIDTH - 1 || rotate < 0 || rotate >= 4) {
+    return false;
+  }
+
+  *action = Action(NORMAL, column, rotate);
+  return true;
+}
+
+MatchResult RunMatch(const Options& options, int index) {
+  MatchResult result;
+  result.index = index;
+  result.winner = -1;
+  result.turn = 0;
+
+  int pack_values[kTURN_MAX][4];
+  GeneratePacks(options.seed + index, pack_values);
+
+  std::string init_input;
+  for (int t = 0; t < kTURN_MAX; t++) {
+    init_input += std::to_string(pack_values[t][0]) + " " + std::to_string(pack_values[t][1]) + "\n" +
+                  std::to_string(pack_values[t][2]) + " " + std::to_string(pack_values[t][3]) + "\nEND\n";
+  }
+
+  FILE* record = nullptr;
+  if (!options.record_dir.empty()) {
+    std::string path = options.record_dir + "/match_" + std::to_string(index) + ".log";
+    record = fopen(path.c_str(), "w");
+    if (record != nullptr) {
+      fputs(init_input.c_str(), record);
+    }
+  }
+
+  Engine engines[COLOR_NB];
+  Player players[COLOR_NB];
+  bool lost[COLOR_NB] = { };
+  std::string reasons[COLOR_NB];
+
+  for (int c = 0; c < COLOR_NB; c++) {
+    std::string stderr_path;
+    if (!options.stderr_dir.empty()) {
+      stderr_path = options.stderr_dir + "/match_" + std::to_string(index) + ((c == WHITE)? "_white" : "_black") + ".txt";
+    }
+
+    std::string name;
+    if (!engines[c].Start(options.commands[c], stderr_path) || !engines[c].ReadLine(&name, kNAME_TIMEOUT) || !engines[c].Send(init_input)) {
+      lost[c] = true;
+      reasons[c] = "failed to start";
+    }
+  }
+
+  for (int turn = 0; turn < kTURN_MAX && !lost[WHITE] && !lost[BLACK]; turn++) {
+    result.turn = turn;
+
+    // 両者に入力を送り、行動を受け取る (両者は同時に思考する)
+    Action actions[COLOR_NB];
+    std::string inputs[COLOR_NB];
+    for (int c = 0; c < COLOR_NB; c++) {
+      inputs[c] = MakeTurnInput(turn, players, (Color)c);
+    }
+    if (record != nullptr) {
+      fputs(inputs[WHITE].c_str(), record);
+    }
+
+    auto think = [&engines, &players, &actions, &lost, &reasons, &inputs](int c) {
+      auto start = std::chrono::steady_clock::now();
+      std::string line;
+      if (!engines[c].Send(inputs[c]) || !engines[c].ReadLine(&line, std::max(players[c].remain_time, 0))) {
+        lost[c] = true;
+        reasons[c] = "no response in time";
+        return;
+      }
+      players[c].remain_time -= std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+      if (!ParseAction(line, &actions[c])) {
+        lost[c] = true;
+        reasons[c] = "invalid action \"" + line + "\"";
+      }
+    };
+
+    std::thread black_thread(think, BLACK);
+    think(WHITE);
+    black_thread.join();
+
+    if (lost[WHITE] || lost[BLACK]) {
+      break;
+    }
+
+    // 行動を適用する
+    Score scores[COLOR_NB];
+    for (int c = 0; c < COLOR_NB; c++) {
+      Player& player = players[c];
+      if (player.ojama_stock >= kWIDTH) {
+        player.position.Attacked();
+        player.ojama_stock -= kWIDTH;
+      }
+
+      if (actions[c].action_type == SKILL) {
+        if (player.skill < kSKILL_GAUGE_REQUIRED) {
+          lost[c] = true;
+          reasons[c] = "skill gauge is not enough";
+          continue;
+        }
+        player.skill = 0;
+        scores[c] = player.position.Simulate(Pack(), actions[c]);
+      } else {
+        const int* v = pack_values[turn];
+        scores[c] = player.position.Simulate(Pack(v[0], v[1], v[2], v[3]), actions[c]);
+      }
+
+      if (scores[c].chain_count > 0) {
+        player.skill = std::min(kSKILL_GAUGE_MAX, player.skill + 8);
+      }
+
+      if (player.position.IsGameOver()) {
+        lost[c] = true;
+        reasons[c] = "danger line";
+      }
+    }
+
+    // 得点とお邪魔、スキルゲージの減少を反映する
+    for (int c = 0; c < COLOR_NB; c++) {
+      Player& player = players[c];
+      Player& opponent = players[1 - c];
+      const int gain = scores[c].chain_score + scores[c].explosion_score;
+      player.score += gain;
+
+      const int attack = gain / 2;
+      const int offset = std::min(attack, player.ojama_stock);
+      player.ojama_stock -= offset;
+      opponent.ojama_stock += attack - offset;
+
+      if (scores[c].chain_count >= 3) {
+        opponent.skill = std::max(0, opponent.skill - (12 + 2 * scores[c].chain_count));
+      }
+    }
+  }
+
+  if (lost[WHITE] && !lost[BLACK]) {
+    result.winner = BLACK;
+    result.reason = "white: " + reasons[WHITE];
+  } else if (!lost[WHITE] && lost[BLACK]) {
+    result.winner = WHITE;
+    result.reason = "black: " + reasons[BLACK];
+  } else if (lost[WHITE] && lost[BLACK]) {
+    result.reason = "both: " + reasons[WHITE] + " / " + reasons[BLACK];
+  } else {
+    result.reason = "turn limit";
+  }
+
+  for (int c = 0; c < COLOR_NB; c++) {
+    result.scores[c] = players[c].score;
+    engines[c].Stop();
+  }
+  if (record != nullptr) {
+    fclose(record);
+  }
+
+  return result;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--white") == 0 && i + 1 < argc) {
+      options.commands[WHITE] = argv[++i];
+    } else if (strcmp(argv[i], "--black") == 0 && i + 1 < argc) {
+      options.commands[BLACK] = argv[++i];
+    } else if (strcmp(argv[i], "--games") == 0 && i + 1 < argc) {
+      options.games = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--parallel") == 0 && i + 1 < argc) {
+      options.parallel = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      options.seed = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      options.record_dir = argv[++i];
+    } else if (strcmp(argv[i], "--stderr") == 0 && i + 1 < argc) {
+      options.stderr_dir = argv[++i];
+    } else {
+      fprintf(stderr, "usage: %s [--white CMD] [--black CMD] [--games N] [--parallel P] [--seed S] [--record DIR] [--stderr DIR]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  // 終了した思考プログラムへの書き込みで落ちないようにする
+  signal(SIGPIPE, SIG_IGN);
+
+  Pack::Init();
+  Position::Init();
+
+  std::vector<MatchResult> results(options.games);
+  std::atomic<int> next_index(0);
+  std::mutex output_mtx;
+
+  auto worker = [&options, &results, &next_index, &output_mtx]() {
+    while (true) {
+      const int index = next_index.fetch_add(1);
+      if (index >= options.games) {
+        break;
+      }
+
+      MatchResult result = RunMatch(options, index);
+      results[index] = result;
+
+      std::lock_guard<std::mutex> lk(output_mtx);
+      printf("match %d: %s (turn %d, score %d - %d, %s)\n", index,
+             (result.winner == WHITE)? "white wins" : (result.winner == BLACK)? "black wins" : "draw",
+             result.turn, result.scores[WHITE], result.scores[BLACK], result.reason.c_str());
+      fflush(stdout);
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < std::min(options.parallel, options.games); i++) {
+    threads.emplace_back(worker);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  int wins[COLOR_NB] = { }, draws = 0, total_turns = 0;
+  for (const MatchResult& result : results) {
+    if (result.winner == -1) {
+      draws++;
+    } else {
+      wins[result.winner]++;
+    }
+    total_turns += result.turn + 1;
+  }
+
+  printf("white %d - %d black (%d draws) in %d games, %.1f turns/game, %.1f s (%.2f games/min)\n",
+         wins[WHITE], wins[BLACK], draws, options.games, (double)total_turns / options.games,
+         elapsed, options.games / (elapsed / 60));
+
+  return 0;
+}
@@ -14,6 +14,10 @@ struct Score {
   int GetScoreSum() const {
     return chain_score + explosion_score + heuristic_score;
   }
+
+  bool operator==(const Score& score) const {
+    return chain_score == score.chain_score && explosion_score == score.explosion_score && heuristic_score == score.heuristic_score && chain_count == score.chain_count;
+  }
 };
 
 
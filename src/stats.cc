@@ -0,0 +1,95 @@
+#include "stats.h"
+
+namespace {
+
+const char* kCOUNTER_NAMES[Stats::SEARCH_NODE_COUNT] = {
+  "simulate",
+  "chain_iteration",
+  "erase_one",
+  "erase_one_candidate",
+  "beam_state",
+  "beam_duplicate",
+  "beam_pruned",
+  "dfs_duplicate",
+  "lock_wait",
+  "time_check",
+  "time_check_ns"
+};
+
+// 使用中の枠のビット集合
+std::atomic<uint64_t> used_slots(0);
+
+static_assert(Stats::kMAX_THREAD_NUM <= 64, "used_slots must have a bit for each slot");
+
+/**
+ * スレッドが確保した枠
+ * thread_localで持ち、スレッドの終了時に枠を解放する。
+ */
+struct SlotOwner {
+  int index;
+
+  SlotOwner(): index(Stats::kMAX_THREAD_NUM) {
+    uint64_t used = used_slots.load(std::memory_order_relaxed);
+    while (~used != 0ULL) {
+      const int free_index = __builtin_ctzll(~used);
+      if (free_index >= Stats::kMAX_THREAD_NUM) {
+        break;
+      }
+      // 解放した枠を再び使う場合に、前の持ち主が書き込んだ値を引き継ぐため、acquire/releaseで受け渡す
+      if (used_slots.compare_exchange_weak(used, used | (1ULL << free_index), std::memory_order_acquire, std::memory_order_relaxed)) {
+        index = free_index;
+        break;
+      }
+    }
+  }
+
+  ~SlotOwner() {
+    if (index < Stats::kMAX_THREAD_NUM) {
+      used_slots.fetch_and(~(1ULL << index), std::memory_order_release);
+    }
+  }
+};
+
+}  // namespace
+
+Stats::Slot Stats::slots[Stats::kMAX_THREAD_NUM + 1];
+
+int Stats::SlotIndex() {
+  static thread_local SlotOwner owner;
+  return owner.index;
+}
+
+void Stats::Clear() {
+  for (int i = 0; i <= kMAX_THREAD_NUM; i++) {
+    for (int counter = 0; counter < COUNTER_NB; counter++) {
+      slots[i].values[counter].store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+int64_t Stats::Sum(Counter counter) {
+  int64_t sum = 0;
+  for (int i = 0; i <= kMAX_THREAD_NUM; i++) {
+    sum += slots[i].values[counter].load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+int64_t Stats::SumSearchNodes() {
+  int64_t sum = 0;
+  for (int depth = 0; depth < kMAX_DEPTH; depth++) {
+    sum += Sum((Counter)(SEARCH_NODE_COUNT + depth));
+  }
+  return sum;
+}
+
+std::string Stats::Format() {
+  std::string line;
+  for (int counter = 0; counter < SEARCH_NODE_COUNT; counter++) {
+    line += std::string((counter == 0)? "" : " ") + kCOUNTER_NAMES[counter] + "=" + std::to_string(Sum((Counter)counter));
+  }
+  for (int depth = 0; depth < kMAX_DEPTH; depth++) {
+    line += " node_depth" + std::to_string(depth) + "=" + std::to_string(Sum((Counter)(SEARCH_NODE_COUNT + depth)));
+  }
+  return line;
+}
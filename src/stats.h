@@ -0,0 +1,128 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <atomic>
+#include <cinttypes>
+#include <mutex>
+#include <string>
+
+/**
+ * 探索中の計算量を数えるカウンタ。
+ * スレッドごとに別のキャッシュラインへ書き込むので、並列に数えても競合しない。
+ * スレッドプールのワーカー以外 (先読みのスレッドなど) も、初めて数えた時点で自分の枠を確保する。
+ *
+ * STATSを定義してコンパイルした場合のみ数える (make STATS=1)。
+ * 定義しない場合、Add()などは空の関数となり、何も計算しない。
+ */
+namespace Stats {
+
+const int kMAX_DEPTH = 8;  // 深さごとに節点数を数える最大の深さ (これより深いものは最後にまとめる)
+
+enum Counter {
+  SIMULATE_COUNT,  // Position::Simulate()で落下処理を行った局面の数
+  CHAIN_ITERATION_COUNT,  // 落下と消去を繰り返した回数 (連鎖数 + 1の合計)
+  ERASE_ONE_COUNT,  // Eval::EraseOne()の呼び出し回数
+  ERASE_ONE_CANDIDATE_COUNT,  // Eval::EraseOne()で消してみたブロックの数
+  BEAM_STATE_COUNT,  // ビームサーチで生成した状態の数
+  BEAM_DUPLICATE_COUNT,  // そのうち、同一局面として取り除いたものの数
+  BEAM_PRUNED_COUNT,  // そのうち、ビーム幅から溢れて捨てたものの数
+  DFS_DUPLICATE_COUNT,  // 深さ優先探索で、他の行動と同じ局面になるため探索しなかった子の数
+  LOCK_WAIT_COUNT,  // 他のスレッドが持っていたために、ロックを待った回数
+  TIME_CHECK_COUNT,  // Deadlineで時刻を読んだ回数
+  TIME_CHECK_NANOSEC,  // Deadlineで時刻を読むのに掛かった時間の合計 (ナノ秒)
+  SEARCH_NODE_COUNT,  // 深さ優先探索で展開した節点の数 (深さ0から深さkMAX_DEPTH - 1まで並ぶ)
+  COUNTER_NB = SEARCH_NODE_COUNT + kMAX_DEPTH
+};
+
+const int kMAX_THREAD_NUM = 64;  // 同時に枠を持てるスレッド数 (これを超えたスレッドは、最後の共有の枠に書き込む)
+
+struct alignas(64) Slot {
+  std::atomic<int64_t> values[COUNTER_NB];
+};
+
+extern Slot slots[kMAX_THREAD_NUM + 1];
+
+/**
+ * 現在のスレッドが書き込む枠の番号を返す。
+ * 初めて呼んだ時に空いている枠を確保し、スレッドの終了時に解放する。
+ * 空いている枠がない場合は、共有の枠kMAX_THREAD_NUMを返す。
+ */
+int SlotIndex();
+
+#ifdef STATS
+
+inline void Add(Counter counter, int64_t value = 1) {
+  const int index = SlotIndex();
+  std::atomic<int64_t>& slot_value = slots[index].values[counter];
+  if (index < kMAX_THREAD_NUM) {
+    // 自分専用の枠なので、読んでから書いても他のスレッドと競合しない
+    slot_value.store(slot_value.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+  } else {
+    slot_value.fetch_add(value, std::memory_order_relaxed);
+  }
+}
+
+/**
+ * 深さdepthの節点を1つ数える。
+ */
+inline void AddNode(int depth) {
+  Add((Counter)(SEARCH_NODE_COUNT + ((depth < kMAX_DEPTH)? depth : kMAX_DEPTH - 1)));
+}
+
+/**
+ * std::lock_guardと同じく、スコープの間mutexを確保する。
+ * すぐに確保できなかった場合は、待った回数を数える。
+ */
+template <class Mutex>
+class LockGuard {
+private:
+  Mutex& mutex;
+
+public:
+  explicit LockGuard(Mutex& mutex): mutex(mutex) {
+    if (!mutex.try_lock()) {
+      Add(LOCK_WAIT_COUNT);
+      mutex.lock();
+    }
+  }
+  ~LockGuard() { mutex.unlock(); }
+
+  LockGuard(const LockGuard&) = delete;
+  LockGuard& operator=(const LockGuard&) = delete;
+};
+
+#else
+
+inline void Add(Counter, int64_t = 1) { }
+inline void AddNode(int) { }
+
+template <class Mutex>
+using LockGuard = std::lock_guard<Mutex>;
+
+#endif
+
+/**
+ * 全てのカウンタを0にする。
+ * 探索を行っていない間に呼ぶこと。
+ */
+void Clear();
+
+/**
+ * 全スレッドの合計を返す。
+ * 探索を行っていない間に呼ぶこと。
+ */
+int64_t Sum(Counter counter);
+
+/**
+ * 深さ優先探索で展開した節点の数の、全ての深さでの合計を返す。
+ */
+int64_t SumSearchNodes();
+
+/**
+ * 全てのカウンタの合計を、"名前=値"を空白区切りで並べた1行にして返す。
+ */
+std::string Format();
+
+}  // namespace Stats
+
+#endif  // STATS_H_
@@ -1,10 +1,10 @@
 #include "stopwatch.h"
 
 void Stopwatch::Start() {
-  start = std::chrono::system_clock::now();
+  start = std::chrono::steady_clock::now();
 }
 
 double Stopwatch::Elapsed() const {
-  auto end = std::chrono::system_clock::now();
-  return std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
 }
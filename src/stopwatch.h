@@ -5,7 +5,7 @@
 
 class Stopwatch {
 private:
-  std::chrono::system_clock::time_point start;
+  std::chrono::steady_clock::time_point start;  // 時刻の変更に影響されないよう、単調な時計を用いる
 
 public:
   void Start();
@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+
+#include "../eval.h"
+#include "../position.h"
+#include "test_positions.h"
+
+#include <vector>
+
+namespace {
+
+/**
+ * 下から順にcolumnのブロックを積んだ局面を作る。
+ */
+Position MakePosition(const std::vector<std::vector<int>>& columns) {
+  Position position;
+  for (int x = 0; x < (int)columns.size(); x++) {
+    for (int i = 0; i < (int)columns[x].size(); i++) {
+      position.Set(kDANGER_HEIGHT - 1 - i, x, columns[x][i]);
+    }
+  }
+  position.Simulate(Pack(), Action(NO_ACTION_TYPE));
+  return position;
+}
+
+/**
+ * テストに使う、手で作った局面
+ */
+std::vector<Position> MakeFixedPositions() {
+  return {
+    // 空の局面
+    Position(),
+    // 0列目の1を消すと、7が3の上に落ちて消える
+    MakePosition({ { 3, 1, 7 }, { 2, 4 } }),
+    // 左右対称なので、同点の候補が複数ある
+    MakePosition({ { 3, 1, 7 }, { 2 }, { }, { }, { }, { }, { }, { }, { 2 }, { 3, 1, 7 } }),
+    // 消えるブロックがない
+    MakePosition({ { 1, 1, 1 }, { 1, 1 }, { 1 } }),
+  };
+}
+
+}  // namespace
+
+TEST(eval_test, erase_one_fixed) {
+  Position::Init();
+
+  std::vector<Position> positions = MakeFixedPositions();
+
+  Point point(-1, -1);
+  int number = -1;
+  Score score = Eval::EraseOne(positions[1], false, &point, &number);
+  ASSERT_EQ(score.chain_count, 1);
+  ASSERT_EQ(point.y, kDANGER_HEIGHT - 2);
+  ASSERT_EQ(point.x, 0);
+  ASSERT_EQ(number, 1);
+
+  // 同点の場合は(y, x)の小さい方を選ぶ
+  Eval::EraseOne(positions[2], false, &point, &number);
+  ASSERT_EQ(point.y, kDANGER_HEIGHT - 2);
+  ASSERT_EQ(point.x, 0);
+}
+
+TEST(eval_test, erase_top_k) {
+  Position::Init();
+
+  std::vector<Position> positions = MakeFixedPositions();
+  for (const Position& position : MakeRandomPositions(300, 8)) {
+    positions.push_back(position);
+  }
+
+  const int k = 8;
+  for (const Position& position : positions) {
+    for (bool ignore_bottom : { false, true }) {
+      Point point(-1, -1);
+      int number = -1;
+      Score score = Eval::EraseOne(position, ignore_bottom, &point, &number);
+
+      Eval::EraseResult results[k];
+      int result_num = Eval::EraseTopK(position, results, k, ignore_bottom);
+      ASSERT_TRUE(0 <= result_num && result_num <= k);
+
+      // 最大得点が正であれば、先頭はEraseOne()の結果と一致する
+      if (score.GetScoreSum() > 0) {
+        ASSERT_GE(result_num, 1);
+        ASSERT_TRUE(score == results[0].score);
+        ASSERT_EQ(point.y, results[0].erase_point.y);
+        ASSERT_EQ(point.x, results[0].erase_point.x);
+        ASSERT_EQ(number, results[0].erase_number);
+      }
+
+      for (int i = 0; i < result_num; i++) {
+        // 得点は降順に並ぶ
+        if (i > 0) {
+          ASSERT_GE(results[i - 1].score.GetScoreSum(), results[i].score.GetScoreSum());
+        }
+
+        // 同じブロックは2回現れず、消したブロックの数字も局面と一致する
+        for (int j = 0; j < i; j++) {
+          ASSERT_FALSE(results[i].erase_point.y == results[j].erase_point.y &&
+                       results[i].erase_point.x == results[j].erase_point.x);
+        }
+        ASSERT_EQ((int)position.Get(results[i].erase_point.y, results[i].erase_point.x), results[i].erase_number);
+
+        // 格納された得点は、そのブロックを消した場合の得点と一致する
+        Position erased = position;
+        Score erased_score = erased.SimulateErase(results[i].erase_point.y, results[i].erase_point.x);
+        ASSERT_TRUE(erased_score == results[i].score);
+      }
+    }
+  }
+}
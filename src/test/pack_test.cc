@@ -86,3 +86,48 @@ TEST(pack_test, handmade_11) {
   ASSERT_TRUE(pack.Count(8) == 0);
   ASSERT_TRUE(pack.Count(9) == 0);
 }
+
+TEST(pack_test, count_empty) {
+  Pack pack(3, 0, 0, 7);
+  ASSERT_TRUE(pack.Count(0) == 2);
+  ASSERT_TRUE(pack.Count(3) == 1);
+  ASSERT_TRUE(pack.Count(7) == 1);
+}
+
+TEST(pack_test, unique_actions_table) {
+  // 表の値と、候補を指定した場合の計算が一致する (候補の範囲外のbitは無視される)
+  for (int data = 0; data < 0x10000; data++) {
+    if ((data & 0xF) > 9 || ((data >> 4) & 0xF) > 9 || ((data >> 8) & 0xF) > 9 || (data >> 12) > 9) {
+      continue;
+    }
+
+    Pack pack(data);
+    ASSERT_TRUE(pack.GetUniqueActions() == pack.GetUniqueActions(Pack::kALL_ACTIONS | (1ULL << 40)));
+  }
+}
+
+TEST(pack_test, unique_actions_same_numbers) {
+  Pack::Init();
+
+  // 回転しても同じ局面になるので、各列に1通りずつ
+  Pack pack(1, 1, 1, 1);
+  ASSERT_TRUE(__builtin_popcountll(pack.GetUniqueActions()) == 9);
+}
+
+TEST(pack_test, unique_actions_single_block) {
+  Pack::Init();
+
+  // ブロックが1つの場合は、ブロックを落とす列の10通り
+  Pack pack(1, 0, 0, 0);
+  ASSERT_TRUE(__builtin_popcountll(pack.GetUniqueActions()) == 10);
+}
+
+TEST(pack_test, unique_actions_candidates) {
+  Pack::Init();
+
+  // 候補から外した行動の代わりに、同じ局面になる候補の行動が残る
+  Pack pack(1, 0, 0, 0);
+  uint64_t without_column_0 = Pack::kALL_ACTIONS & ~0b1111ULL;
+  ASSERT_TRUE(__builtin_popcountll(pack.GetUniqueActions(without_column_0)) == 9);
+  ASSERT_TRUE((pack.GetUniqueActions(without_column_0) & ~without_column_0) == 0);
+}
@@ -0,0 +1,237 @@
+#include <gtest/gtest.h>
+
+#include "../position.h"
+#include "../bitboard.h"
+#include "test_positions.h"
+
+#include <random>
+#include <vector>
+
+namespace {
+
+bool IsSameHeights(const Position& position) {
+  for (int x = 0; x < kWIDTH; x++) {
+    int y = 0;
+    while (y < kDANGER_HEIGHT && position.Get(y, x) == 0) {
+      y++;
+    }
+    if (position.GetHeight(x) != kDANGER_HEIGHT - y) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST(position_test, hash_empty) {
+  Position::Init();
+
+  Position position;
+  ASSERT_TRUE(position.Hash() == 0ULL);
+}
+
+TEST(position_test, hash_equal) {
+  Position::Init();
+
+  Position position1, position2;
+  position1.Simulate(Pack(9, 5, 0, 3), Action(NORMAL, 3, 1));
+  position2.Simulate(Pack(9, 5, 0, 3), Action(NORMAL, 3, 1));
+  ASSERT_TRUE(position1 == position2);
+  ASSERT_TRUE(position1.Hash() == position2.Hash());
+}
+
+TEST(position_test, hash_different) {
+  Position::Init();
+
+  Position position1, position2;
+  position1.Simulate(Pack(9, 5, 0, 3), Action(NORMAL, 3, 1));
+  position2.Simulate(Pack(9, 5, 0, 3), Action(NORMAL, 4, 1));
+  ASSERT_TRUE(position1 != position2);
+  ASSERT_TRUE(position1.Hash() != position2.Hash());
+}
+
+TEST(position_test, heights) {
+  Position::Init();
+
+  for (const Position& position : MakeRandomPositions(200, 4)) {
+    ASSERT_TRUE(IsSameHeights(position));
+
+    Position skilled = position;
+    skilled.Simulate(Pack(), Action(SKILL));
+    ASSERT_TRUE(IsSameHeights(skilled));
+
+    Position attacked = position;
+    attacked.Attacked(2);
+    ASSERT_TRUE(IsSameHeights(attacked));
+
+    Position converted;
+    Bitboard(position).Store(&converted);
+    ASSERT_TRUE(IsSameHeights(converted));
+
+    for (int x = 0; x < kWIDTH; x++) {
+      if (position.GetHeight(x) == 0) {
+        continue;
+      }
+      Position erased = position;
+      erased.Set(kDANGER_HEIGHT - 1, x, 0);
+      erased.Simulate(Pack(), Action(NO_ACTION_TYPE));
+      ASSERT_TRUE(IsSameHeights(erased));
+    }
+  }
+}
+
+TEST(position_test, bitboard_convert) {
+  Position::Init();
+
+  for (const Position& position : MakeRandomPositions(200, 1)) {
+    Position converted;
+    Bitboard(position).Store(&converted);
+    ASSERT_TRUE(position == converted);
+  }
+}
+
+TEST(position_test, bitboard_simulate) {
+  Position::Init();
+
+  std::mt19937 engine(2);
+  for (const Position& position : MakeRandomPositions(300, 3)) {
+    Pack pack(engine() % 10, engine() % 10, engine() % 10, engine() % 10);
+
+    for (int column = 0; column < 9; column++) {
+      for (int rotate = 0; rotate < 4; rotate++) {
+        Position expected = position;
+        Score expected_score = expected.Simulate(pack, Action(NORMAL, column, rotate));
+
+        Bitboard bitboard(position);
+        Score score = bitboard.Simulate(pack, Action(NORMAL, column, rotate));
+
+        Position actual;
+        bitboard.Store(&actual);
+        ASSERT_TRUE(expected_score == score);
+        ASSERT_TRUE(expected == actual);
+      }
+    }
+
+    {
+      Position expected = position;
+      Score expected_score = expected.Simulate(Pack(), Action(SKILL));
+
+      Bitboard bitboard(position);
+      Score score = bitboard.Simulate(Pack(), Action(SKILL));
+
+      Position actual;
+      bitboard.Store(&actual);
+      ASSERT_TRUE(expected_score == score);
+      ASSERT_TRUE(expected == actual);
+    }
+  }
+}
+
+TEST(position_test, bitboard_attacked) {
+  Position::Init();
+
+  for (const Position& position : MakeRandomPositions(200, 4)) {
+    for (int attack_num = 1; attack_num <= 3; attack_num++) {
+      Position expected = position;
+      expected.Attacked(attack_num);
+
+      Bitboard bitboard(position);
+      bitboard.Attacked(attack_num);
+
+      Position actual;
+      bitboard.Store(&actual);
+      ASSERT_TRUE(expected == actual);
+    }
+  }
+}
+
+TEST(position_test, simulate_batch) {
+  Position::Init();
+
+  std::mt19937 engine(5);
+  const std::vector<Position> random_positions = MakeRandomPositions(500, 6);
+
+  // 大きさの異なるいくつかのまとまりで計算する
+  for (int n : { 1, 7, 16, 36, 100 }) {
+    for (int begin = 0; begin + n <= (int)random_positions.size(); begin += n) {
+      std::vector<Position> positions(random_positions.begin() + begin, random_positions.begin() + begin + n);
+      std::vector<Pack> packs;
+      std::vector<Action> actions;
+      for (int i = 0; i < n; i++) {
+        packs.emplace_back(engine() % 10, engine() % 10, engine() % 10, engine() % 10);
+        actions.push_back((engine() % 10 == 0)? Action(SKILL) : Action(NORMAL, engine() % 9, engine() % 4));
+      }
+
+      std::vector<Score> scores(n);
+      Position::SimulateBatch(positions.data(), packs.data(), actions.data(), scores.data(), n);
+
+      for (int i = 0; i < n; i++) {
+        Position expected = random_positions[begin + i];
+        Score expected_score = expected.Simulate(packs[i], actions[i]);
+        ASSERT_TRUE(expected_score == scores[i]);
+        ASSERT_TRUE(expected == positions[i]);
+      }
+    }
+  }
+}
+
+TEST(position_test, unique_actions) {
+  Pack::Init();
+  Position::Init();
+
+  std::mt19937 engine(20190328);
+  for (const Position& position : MakeRandomPositions(200, 5)) {
+    // 0や同じ数字を含むpackを多めに選ぶ
+    Pack pack(engine() % 4, engine() % 4, engine() % 4, engine() % 4);
+    const uint64_t unique_actions = pack.GetUniqueActions();
+
+    Position results[36];
+    Score scores[36];
+    for (int index = 0; index < 36; index++) {
+      results[index] = position;
+      scores[index] = results[index].Simulate(pack, Action(NORMAL, index / 4, index % 4));
+    }
+
+    // 除かれた行動は、より番号の小さい残った行動と同じ結果になる
+    for (int index = 0; index < 36; index++) {
+      if ((unique_actions >> index) & 1) {
+        continue;
+      }
+
+      bool found = false;
+      for (int other = 0; other < index; other++) {
+        if (((unique_actions >> other) & 1) && results[other] == results[index] && scores[other] == scores[index]) {
+          found = true;
+          break;
+        }
+      }
+      ASSERT_TRUE(found);
+    }
+  }
+}
+
+TEST(position_test, simulate_erase) {
+  Pack::Init();
+  Position::Init();
+
+  for (const Position& position : MakeRandomPositions(200, 6)) {
+    for (int y = 0; y < kDANGER_HEIGHT; y++) {
+      for (int x = 0; x < kWIDTH; x++) {
+        if (position.Get(y, x) == 0) {
+          continue;
+        }
+
+        Position expected = position;
+        expected.Set(y, x, 0);
+        Score expected_score = expected.Simulate(Pack(), Action(NO_ACTION_TYPE));
+
+        Position actual = position;
+        Score actual_score = actual.SimulateErase(y, x);
+        ASSERT_TRUE(expected_score == actual_score);
+        ASSERT_TRUE(expected == actual);
+        ASSERT_TRUE(IsSameHeights(actual));
+      }
+    }
+  }
+}
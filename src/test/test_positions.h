@@ -0,0 +1,36 @@
+#ifndef TEST_POSITIONS_H_
+#define TEST_POSITIONS_H_
+
+#include "../action.h"
+#include "../pack.h"
+#include "../position.h"
+
+#include <random>
+#include <vector>
+
+/**
+ * 乱数で選んだpackを落とし続け、テスト用の局面を集める。
+ */
+inline std::vector<Position> MakeRandomPositions(int num, int seed) {
+  std::mt19937 engine(seed);
+  std::vector<Position> positions;
+
+  Position position;
+  while ((int)positions.size() < num) {
+    Pack pack(engine() % 10, engine() % 10, engine() % 10, engine() % 10);
+    Position next = position;
+    next.Simulate(pack, Action(NORMAL, engine() % 9, engine() % 4));
+
+    if (next.IsGameOver()) {
+      position = Position();
+      continue;
+    }
+
+    position = next;
+    positions.push_back(position);
+  }
+
+  return positions;
+}
+
+#endif  // TEST_POSITIONS_H_
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+
+#include "../transposition.h"
+#include "../types.h"
+
+#include <random>
+#include <vector>
+
+TEST(transposition_test, probe_empty) {
+  TranspositionTable table;
+  Score score;
+  ASSERT_FALSE(table.Probe(TranspositionTable::MakeKey(12345, 1), &score));
+
+  table.Resize(8);
+  ASSERT_FALSE(table.Probe(TranspositionTable::MakeKey(12345, 1), &score));
+}
+
+TEST(transposition_test, store_probe) {
+  TranspositionTable table;
+  table.Resize(8);
+
+  const std::vector<Score> scores = {
+    Score(),
+    Score(1234, 56, 789, 12),
+    Score(0, 0, -INF, 0),
+    Score(0, 0, -INF + 3, 0),
+    Score(-5, -6, -7, 255),
+    Score(2147483647, -2147483647 - 1, INF, 0),
+  };
+  const std::vector<Action> actions = {
+    Action(NO_ACTION_TYPE),
+    Action(NORMAL, 0, 0),
+    Action(NORMAL, 8, 3),
+    Action(SKILL),
+    Action(RESIGN),
+  };
+
+  uint64_t hash = 1;
+  for (const Score& score : scores) {
+    for (const Action& action : actions) {
+      const uint64_t key = TranspositionTable::MakeKey(hash++, 2, 3, 4);
+      table.Store(key, score, action);
+
+      Score probed_score;
+      Action probed_action;
+      ASSERT_TRUE(table.Probe(key, &probed_score, &probed_action));
+      ASSERT_TRUE(probed_score == score);
+      ASSERT_TRUE(probed_action == action);
+    }
+  }
+
+  // actionを省略した場合は、NO_ACTION_TYPEとして格納される
+  const uint64_t key = TranspositionTable::MakeKey(hash, 2);
+  table.Store(key, Score(0, 0, -INF + 1, 0));
+
+  Score probed_score;
+  Action probed_action(NORMAL, 4, 2);
+  ASSERT_TRUE(table.Probe(key, &probed_score, &probed_action));
+  ASSERT_TRUE(probed_score == Score(0, 0, -INF + 1, 0));
+  ASSERT_TRUE(probed_action == Action(NO_ACTION_TYPE));
+}
+
+TEST(transposition_test, make_key) {
+  // 探索条件が異なれば、同じ局面でも別のキーになる
+  ASSERT_NE(TranspositionTable::MakeKey(100, 1), TranspositionTable::MakeKey(100, 2));
+  ASSERT_NE(TranspositionTable::MakeKey(100, 1, 2), TranspositionTable::MakeKey(100, 1, 3));
+  ASSERT_NE(TranspositionTable::MakeKey(100, 1, 2, 3), TranspositionTable::MakeKey(100, 1, 2, 4));
+  ASSERT_EQ(TranspositionTable::MakeKey(100, 1, 2, 3), TranspositionTable::MakeKey(100, 1, 2, 3));
+
+  // キー0は使わない
+  std::mt19937_64 engine(5);
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_NE(TranspositionTable::MakeKey(engine(), engine() % 20, engine() % 20), 0ULL);
+  }
+}
+
+TEST(transposition_test, collision) {
+  const int bits = 8;
+  TranspositionTable table;
+  table.Resize(bits);
+
+  // 下位bitsビットが等しい2つのキーは、同じ要素に格納される
+  const uint64_t key1 = 0x123456789ABCDE01ULL;
+  const uint64_t key2 = key1 ^ (1ULL << 40);
+
+  Score score;
+  Action action;
+  table.Store(key1, Score(10, 20, 30, 2), Action(NORMAL, 3, 1));
+  ASSERT_FALSE(table.Probe(key2, &score, &action));
+  ASSERT_TRUE(table.Probe(key1, &score, &action));
+  ASSERT_TRUE(score == Score(10, 20, 30, 2));
+
+  // 後から格納したもので上書きされる
+  table.Store(key2, Score(0, 0, -INF + 2, 0), Action(NO_ACTION_TYPE));
+  ASSERT_FALSE(table.Probe(key1, &score, &action));
+  ASSERT_TRUE(table.Probe(key2, &score, &action));
+  ASSERT_TRUE(score == Score(0, 0, -INF + 2, 0));
+  ASSERT_TRUE(action == Action(NO_ACTION_TYPE));
+
+  // 別の要素に格納したものは影響しない
+  const uint64_t key3 = key1 + 1;
+  table.Store(key3, Score(1, 2, 3, 4), Action(SKILL));
+  ASSERT_TRUE(table.Probe(key2, &score, &action));
+  ASSERT_TRUE(table.Probe(key3, &score, &action));
+  ASSERT_TRUE(score == Score(1, 2, 3, 4));
+  ASSERT_TRUE(action == Action(SKILL));
+
+  table.Clear();
+  ASSERT_FALSE(table.Probe(key2, &score, &action));
+  ASSERT_FALSE(table.Probe(key3, &score, &action));
+}
@@ -1,8 +1,13 @@
 #include "think.h"
 #include "stopwatch.h"
+#include "deadline.h"
+#include "time_manager.h"
 #include "score.h"
 #include "eval.h"
 #include "types.h"
+#include "thread_pool.h"
+#include "stats.h"
+#include "transposition.h"
 
 #include <cstring>
 #include <iostream>
@@ -10,8 +15,9 @@
 #include <queue>
 #include <algorithm>
 #include <random>
-#include <thread>
 #include <mutex>
+#include <atomic>
+#include <thread>
 
 namespace {
 
@@ -19,22 +25,88 @@ enum Mode {
   CHAIN_MODE, SKILL_MODE
 };
 
+/**
+ * 置換表に格納する探索結果の種類
+ */
+enum TranspositionKind {
+  CURRENT_CHAIN_KIND,  // CalculateCurrentChainScore()の結果
+  CHAIN_LEAF_KIND,  // ChainSearch()の末端での評価値
+  CHAIN_NODE_KIND  // ChainSearch()の途中の節点での探索結果
+};
+
+const int kTRANSPOSITION_TABLE_BITS = 22;  // 置換表の要素数 (2の冪)
+
 std::mt19937_64 engine(20190328);
 
 Game game;
 
+Deadline deadline;  // 探索の打ち切り (複数のスレッドから確認する)
+
+const int kMIN_ITERATION_DEPTH = 2;  // 反復深化を始める深さ
+const int kMIN_SEARCH_DEPTH = 3;  // 時間に関わらず、必ず最後まで探索する深さ
+const int kMAX_SEARCH_DEPTH = 6;  // 反復深化で探索する最大の深さ (op_damaged_scores[depth + 2]が範囲に収まるように)
+const double kMIN_DEPTH_GROWTH = 20.0;  // 1つ深くした際に、探索時間が何倍になるかの見込みの下限
+const double kPARTIAL_SEARCH_RATIO = 0.25;  // 途中までの結果を使える場合、見込みの探索時間のこの割合の時間があれば次の深さを始める
+
+int fixed_search_depth = 0;  // 0でない場合は、時間に関わらずこの深さまで探索する
+std::atomic<bool> search_interrupted(false);  // 反復深化の途中で時間切れになったかどうか
+thread_local int interrupt_count = 0;  // このスレッドで探索を打ち切った回数 (子の探索が打ち切られたかの判定に用いる)
+
+std::atomic<bool> pondering(false);  // 先読み中かどうか
+
+/**
+ * 深さdepth_maxの探索を、時間切れで打ち切るべきかどうか。
+ * kMIN_SEARCH_DEPTHまでの探索と、深さを固定している場合は打ち切らない (先読み中は常に打ち切る)。
+ */
+bool IsInterrupted(int depth_max) {
+  if (!pondering && (fixed_search_depth > 0 || depth_max <= kMIN_SEARCH_DEPTH)) {
+    return false;
+  }
+
+  if (deadline.IsExpired()) {
+    search_interrupted = true;
+    interrupt_count++;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * ChainSearch()とCalculateCurrentChainScore()で共有する置換表。
+ * 局面とpackの番号のみで結果が決まるものは、ターンをまたいでそのまま使い回す。
+ * 相手の連鎖の情報などターンごとに変わる値に依存するものは、キーに探索の世代を含める。
+ */
+TranspositionTable transposition_table;
+int64_t search_generation = 0;
+
 /**
  * 与えられたpositionで、最大の連鎖スコアを全探索により探索する。
  */
 Score CalculateCurrentChainScore(const Position& position, int ojama_stock, int depth, int depth_max, bool attacked_delay = false) {
+  Stats::AddNode(depth);
   Score score_max;
 
   if (depth >= depth_max) {
     return Score();
   }
 
+  const uint64_t key = TranspositionTable::MakeKey(position.Hash(),
+                                                   4 * (game.turn + depth) + CURRENT_CHAIN_KIND,
+                                                   depth_max - depth,
+                                                   2 * ojama_stock + attacked_delay);
+  if (transposition_table.Probe(key, &score_max)) {
+    return score_max;
+  }
+
+  // 落とした後の局面が同じになる行動は、1つだけ調べればよい
+  const uint64_t unique_actions = game.packs[game.turn + depth].GetUniqueActions();
+
   for (int column = 0; column < 9; column++) {
     for (int rotation = 0; rotation < 4; rotation++) {
+      if (((unique_actions >> (column * 4 + rotation)) & 1) == 0) {
+        continue;
+      }
+
       Action action = Action(NORMAL, column, rotation);
       Position p = position;
 
@@ -60,26 +132,51 @@ Score CalculateCurrentChainScore(const Position& position, int ojama_stock, int
     }
   }
 
+  transposition_table.Store(key, score_max);
   return score_max;
 }
 
-struct DepthFirstSearch {
-  Position position;  // 探索開始局面
-  int ojama_stock;  // 落下予定のお邪魔の数
-
-  // 探索後、以下の変数たちに値が格納される
-  Score score;
-  Action action;
-
-  // FillOut系の関数を呼ぶと以下の変数たちに値が格納される
+/**
+ * 相手がn手後までに獲得できる点数の表
+ *
+ * 自分の探索と並行して計算する。
+ * 0手後の点数 (op_scores[0]) はFillOutOpScoreTable()から戻った時点で確定しているが、
+ * それ以外の値は、探索中に必要になった節点でのみOpScore()などを通して計算の終了を待つ。
+ */
+struct OpponentTables {
   Score op_scores[8];  // n手後までに獲得できる相手の点数
   Score op_damaged_scores[8];  // お邪魔を受けた場合
-  Score op_eval;
-  Score op_skill_score;
 
-  DepthFirstSearch(): score(Score()), action(Action(NORMAL, 0, 0)) { }
+  std::mutex mtx;
+  TaskGroup pending;  // 計算中のタスク
+
+  OpponentTables() = default;
+  OpponentTables(const OpponentTables&) = delete;
+  OpponentTables& operator=(const OpponentTables&) = delete;
+
+  ~OpponentTables() {
+    pending.Wait();
+  }
+
+  const Score& OpScore(int depth) {
+    if (depth > 0) {
+      WaitReady();
+    }
+    return op_scores[depth];
+  }
+
+  const Score& OpDamagedScore(int depth) {
+    WaitReady();
+    return op_damaged_scores[depth];
+  }
+
+  /**
+   * 表を埋める。
+   * asyncの場合、depth + 1手目以降の計算はpendingに登録し、終了を待たずに戻る。
+   */
+  void FillOutOpScoreTable(const Position& current_position, int depth, int depth_max, int ojama_stock, bool async = false) {
+    Stats::AddNode(depth);
 
-  void FillOutOpScoreTable(const Position& current_position, int depth, int depth_max, int ojama_stock, bool parallel = false) {
     if (depth >= depth_max) {
       for (int i = depth; i < 8; i++) {
         op_scores[i] = op_scores[i - 1];
@@ -90,7 +187,6 @@ struct DepthFirstSearch {
 
     if (depth == 0) {
       memset(op_scores, 0, sizeof(op_scores));
-      op_eval = Eval::EraseOne(game.positions[BLACK]);
     } else {
       if (op_scores[depth - 1].chain_count > op_scores[depth].chain_count) {
         op_scores[depth] = op_scores[depth - 1];
@@ -103,46 +199,49 @@ struct DepthFirstSearch {
       ojama_stock -= kWIDTH;
     }
 
-    std::vector<std::thread> workers;
-    std::mutex mtx;
+    // 先にこの手で連鎖するものを全て調べ、op_scores[depth]を確定させてから次の手を調べる
+    // (次の手の計算はop_scores[depth]を参照するため)
+    Position next_positions[36];
+    int next_num = 0;
 
-    auto search_func = [this, &mtx, &position, &depth, &depth_max, &ojama_stock](int column, int rotation) {
-      Action action = Action(NORMAL, column, rotation);
-      Position next_position = position;
-      Score score = next_position.Simulate(game.packs[game.turn + depth], action);
+    const uint64_t unique_actions = game.packs[game.turn + depth].GetUniqueActions();
+    for (int index = 0; index < 36; index++) {
+      if (((unique_actions >> index) & 1) == 0) {
+        continue;
+      }
+
+      Position& next_position = next_positions[next_num];
+      next_position = position;
+      Score score = next_position.Simulate(game.packs[game.turn + depth], Action(NORMAL, index / 4, index % 4));
 
       if (next_position.IsGameOver()) {
-        return;
+        continue;
       }
 
       if (score.chain_count == 0 || (score.chain_count == 1 && game.packs[game.turn + depth].IsFlammable())) {
-        FillOutOpScoreTable(next_position, depth + 1, depth_max, ojama_stock);
+        next_num++;
       } else {
-        std::lock_guard<std::mutex> lk(mtx);
+        Stats::LockGuard<std::mutex> lk(mtx);
         if (score.chain_count > op_scores[depth].chain_count) {
           op_scores[depth] = score;
         }
       }
-    };
-
-    for (int column = 0; column < 9; column++) {
-      for (int rotation = 0; rotation < 4; rotation++) {
-        if (parallel) {
-          workers.emplace_back(search_func, column, rotation);
-        } else {
-          search_func(column, rotation);
-        }
-      }
     }
 
-    if (parallel) {
-      for (auto& worker : workers) {
-        worker.join();
+    for (int i = 0; i < next_num; i++) {
+      if (async) {
+        ThreadPool::Submit(pending, [this, next_position = next_positions[i], depth, depth_max, ojama_stock]() {
+          FillOutOpScoreTable(next_position, depth + 1, depth_max, ojama_stock);
+        });
+      } else {
+        FillOutOpScoreTable(next_positions[i], depth + 1, depth_max, ojama_stock);
       }
     }
   }
 
-  void FillOutOpDamagedScoreTable(const Position& current_position, int depth, int depth_max, bool parallel = false) {
+  void FillOutOpDamagedScoreTable(const Position& current_position, int depth, int depth_max, bool async = false) {
+    Stats::AddNode(depth);
+
     if (depth >= depth_max) {
       for (int i = depth; i < 8; i++) {
         op_damaged_scores[i] = op_damaged_scores[i - 1];
@@ -164,50 +263,102 @@ struct DepthFirstSearch {
       position.Attacked();
     }
 
-    std::vector<std::thread> workers;
-    std::mutex mtx;
+    Position next_positions[36];
+    int next_num = 0;
 
-    auto search_func = [this, &mtx, &position, &depth, &depth_max](int column, int rotation) {
-      Action action = Action(NORMAL, column, rotation);
-      Position next_position = position;
-      Score score = next_position.Simulate(game.packs[game.turn + depth], action);
+    const uint64_t unique_actions = game.packs[game.turn + depth].GetUniqueActions();
+    for (int index = 0; index < 36; index++) {
+      if (((unique_actions >> index) & 1) == 0) {
+        continue;
+      }
+
+      Position& next_position = next_positions[next_num];
+      next_position = position;
+      Score score = next_position.Simulate(game.packs[game.turn + depth], Action(NORMAL, index / 4, index % 4));
 
       if (next_position.IsGameOver()) {
-        return;
+        continue;
       }
 
       if (score.chain_count == 0 || (score.chain_count == 1 && game.packs[game.turn + depth].IsFlammable())) {
-        FillOutOpDamagedScoreTable(next_position, depth + 1, depth_max);
+        next_num++;
       } else {
-        std::lock_guard<std::mutex> lk(mtx);
+        Stats::LockGuard<std::mutex> lk(mtx);
         if (score.chain_count > op_damaged_scores[depth].chain_count) {
           op_damaged_scores[depth] = score;
         }
       }
-    };
-
-    for (int column = 0; column < 9; column++) {
-      for (int rotation = 0; rotation < 4; rotation++) {
-        if (parallel) {
-          workers.emplace_back(search_func, column, rotation);
-        } else {
-          search_func(column, rotation);
-        }
-      }
     }
 
-    if (parallel) {
-      for (auto& worker : workers) {
-        worker.join();
+    for (int i = 0; i < next_num; i++) {
+      if (async) {
+        ThreadPool::Submit(pending, [this, next_position = next_positions[i], depth, depth_max]() {
+          FillOutOpDamagedScoreTable(next_position, depth + 1, depth_max);
+        });
+      } else {
+        FillOutOpDamagedScoreTable(next_positions[i], depth + 1, depth_max);
       }
     }
   }
 
+private:
+  void WaitReady() {
+    // 待っている間に実行した他のタスクが打ち切られても、呼び出し元の探索の打ち切りとは数えない
+    const int count = interrupt_count;
+    pending.Wait();
+    interrupt_count = count;
+  }
+};
+
+/**
+ * 1ターンの探索で、全ての節点が共有する情報
+ * 探索を始める前に用意し、探索中は変更しない。子の探索には複製せず、参照のみを渡す。
+ */
+struct SearchContext {
+  OpponentTables* op_tables;  // 相手の連鎖の表
+
+  // EvaluateRoot()を呼ぶと以下の変数たちに値が格納される
+  Score my_skill_score;
+  Score op_skill_score;
+
+  SearchContext(): op_tables(nullptr) { }
+
+  /**
+   * 現局面でスキルを使った場合の得点を、自分と相手について計算する。
+   */
+  void EvaluateRoot() {
+    Position my_position = game.positions[WHITE];
+    my_skill_score = my_position.Simulate(Pack(), Action(SKILL));
+
+    Position op_position = game.positions[BLACK];
+    op_skill_score = op_position.Simulate(Pack(), Action(SKILL));
+  }
+};
+
+struct DepthFirstSearch {
+  Position position;  // 探索開始局面
+  int ojama_stock;  // 落下予定のお邪魔の数
+
+  // 探索後、以下の変数たちに値が格納される
+  Score score;
+  Action action;
+
+  const SearchContext* context;  // このターンの探索で共有する情報
+
+  // ChainSearch()のdepth 0でのみ用いる
+  Action first_actions[2];  // 先に探索する行動 (前回の反復の最善手、前のターンの読み筋)
+  bool first_completed;  // 最初に探索した子を、時間切れで打ち切られずに探索し終えたかどうか
+  Action next_action;  // 最善手の次の手の最善手 (次のターンの読み筋)
+
+  explicit DepthFirstSearch(const SearchContext& context): score(Score()), action(Action(NORMAL, 0, 0)), context(&context), first_completed(false) { }
+
   /**
    * 深さ優先探索により、positionのscoreを算出する。
    * 大きな連鎖をするように探索する。
    */
   Score ChainSearch(int depth, int depth_max, bool parallel = false) {
+    Stats::AddNode(depth);
+
     if (depth >= depth_max) {
       // 最大探索深さに到達
 
@@ -225,9 +376,20 @@ struct DepthFirstSearch {
         return Score(0, 0, -INF + depth, 0);
       }
 
-      Score score;
-      if (game.ojama_stock[WHITE] < kWIDTH && position.GetPackedCells(6) == 0) {
+      const bool damaged = (game.ojama_stock[WHITE] < kWIDTH && position.GetPackedCells(6) == 0);
+      if (damaged) {
         position.Attacked(4);
+      }
+
+      // 評価値は局面と評価するターンのみで決まる
+      const uint64_t key = TranspositionTable::MakeKey(position.Hash(), 4 * (game.turn + depth) + CHAIN_LEAF_KIND, damaged);
+
+      Score score;
+      if (transposition_table.Probe(key, &score)) {
+        return score;
+      }
+
+      if (damaged) {
         score = Eval::EraseOne(position, false, &erase_point, &erase_number);
       } else {
         score = Eval::EraseOne(position, false, &erase_point, &erase_number);
@@ -256,9 +418,24 @@ struct DepthFirstSearch {
         }
       }
 
+      transposition_table.Store(key, score);
       return score;
     }
 
+    // 時間切れの場合は、この深さの探索を諦める (結果は呼び出し元で捨てられる)
+    if (depth > 0 && IsInterrupted(depth_max)) {
+      return Score(0, 0, -INF + depth, 0);
+    }
+
+    // 途中の節点の探索結果は、このターンの探索の間のみ使い回す
+    uint64_t key = 0;
+    if (depth > 0) {
+      key = TranspositionTable::MakeKey(position.Hash(), 4 * search_generation + CHAIN_NODE_KIND, 64 * depth + depth_max, ojama_stock);
+      if (transposition_table.Probe(key, &this->score, &this->action)) {
+        return this->score;
+      }
+    }
+
     Score best_score = Score(0, 0, -INF + depth, 0);
     Action best_action = Action(NORMAL, 0, 0);
     std::mutex mtx;
@@ -266,33 +443,24 @@ struct DepthFirstSearch {
     Position current_position = position;
     int current_ojama_stock = ojama_stock;
 
-    if (current_ojama_stock >= kWIDTH || (depth > 0 && (op_scores[0].chain_count >= 11))) {
+    if (current_ojama_stock >= kWIDTH || (depth > 0 && (context->op_tables->OpScore(0).chain_count >= 11))) {
       // お邪魔ブロックが降ってくる または
       // 相手が1ターン前に攻撃している可能性がある場合には、お邪魔ブロックが降ってくる前提で考える
       current_position.Attacked();
       current_ojama_stock -= kWIDTH;
     }
 
-    Score my_skill_score, my_eval, op_damaged_score, damaged_score;
+    Score op_damaged_score, damaged_score;
 
     if (depth == 0) {
-      my_eval = Eval::EraseOne(game.positions[WHITE]);
-
-      {
-        Position my_position = game.positions[WHITE];
-        my_skill_score = my_position.Simulate(Pack(), Action(SKILL));
-      }
-
-      {
-        Position op_position = game.positions[BLACK];
-        op_skill_score = op_position.Simulate(Pack(), Action(SKILL));
-      }
-
-      int ojama_predict = std::max(op_scores[0].chain_score / 2, op_skill_score.explosion_score / 2);
+      // my_skill_score, op_skill_scoreは、EvaluateRoot()で計算済み
+      const Score& my_skill_score = context->my_skill_score;
+      const Score& op_skill_score = context->op_skill_score;
+      int ojama_predict = std::max(context->op_tables->OpScore(0).chain_score / 2, op_skill_score.explosion_score / 2);
       damaged_score = CalculateCurrentChainScore(current_position, ojama_predict, 1, 4);
 
       if (game.skills[WHITE] >= 80) {
-        if (my_skill_score.explosion_score >= 10 * kWIDTH && game.ojama_stock[BLACK] < kWIDTH && my_skill_score.explosion_score + 2 * game.ojama_stock[BLACK] >= 2 * kWIDTH && my_skill_score.explosion_score >= op_scores[0].GetScoreSum()) {
+        if (my_skill_score.explosion_score >= 10 * kWIDTH && game.ojama_stock[BLACK] < kWIDTH && my_skill_score.explosion_score + 2 * game.ojama_stock[BLACK] >= 2 * kWIDTH && my_skill_score.explosion_score >= context->op_tables->OpScore(0).GetScoreSum()) {
           if (game.skills[BLACK] < 80 || my_skill_score.explosion_score >= op_skill_score.GetScoreSum()) {
             this->score = my_skill_score;
             this->action = Action(SKILL);
@@ -303,109 +471,194 @@ struct DepthFirstSearch {
       }
     }
 
-    std::vector<std::thread> workers;
+    // 子の局面を先にまとめて計算し、ゲームオーバーとなるものと、
+    // 他の行動と同じ局面・同じ得点になるもの (以降の探索結果も同じになる) は探索しない
+    // 多くはpackの回転のみで決まるので、Pack::GetUniqueActions()で落とす前に除き、残りは局面を比べる
+    Position child_positions[36];
+    Score child_scores[36];
+    int order[36];  // 探索する子の番号 (column * 4 + rotation) を、探索する順に並べたもの
+    int child_num = 0;
+    {
+      const uint64_t unique_actions = game.packs[game.turn + depth].GetUniqueActions();
+      uint64_t hashes[36];
+      for (int index = 0; index < 36; index++) {
+        // packのみで同じ局面になるとわかる行動は、落とすまでもなく除く
+        if (((unique_actions >> index) & 1) == 0) {
+          continue;
+        }
+
+        child_positions[index] = current_position;
+        child_scores[index] = child_positions[index].Simulate(game.packs[game.turn + depth], Action(NORMAL, index / 4, index % 4));
 
-    for (int column = 0; column < 9; column++) {
-      for (int rotation = 0; rotation < 4; rotation++) {
-        auto search_func = [this, &mtx, &current_position, &current_ojama_stock, &depth, &depth_max, &my_skill_score, &my_eval, &op_damaged_score, &damaged_score, &best_score, &best_action](int column, int rotation) {
-          DepthFirstSearch dfs;
-          dfs.position = current_position;
-          dfs.ojama_stock = current_ojama_stock;
-          memcpy(dfs.op_scores, this->op_scores, sizeof(this->op_scores));  // ToDo: コピーが必要のない実装
-          memcpy(dfs.op_damaged_scores, this->op_damaged_scores, sizeof(this->op_damaged_scores));  // ToDo: コピーが必要のない実装
-          dfs.op_eval = this->op_eval;
-          dfs.op_skill_score = this->op_skill_score;
-
-          Score current_score = dfs.position.Simulate(game.packs[game.turn + depth], Action(NORMAL, column, rotation));
-
-          if (dfs.position.IsGameOver()) {
-            return;
-          }
+        if (child_positions[index].IsGameOver()) {
+          continue;
+        }
 
-          Score future_score = Score();
-          /**
-           * 連鎖をしていない、または回避できない1連鎖の場合には、1手進めそこでのスコアを用いる。
-           * 連鎖をした場合には、探索を打ち切り、現局面でのスコアを用いる。
-           */
-          if (current_score.chain_count == 0 || (current_score.chain_count == 1 && game.packs[game.turn + depth].IsFlammable())) {
-            future_score = dfs.ChainSearch(depth + 1, depth_max);
-          } else {
-            future_score = dfs.ChainSearch(depth_max, depth_max);
+        hashes[index] = child_positions[index].Hash();
+        bool duplicate = false;
+        for (int i = 0; i < child_num; i++) {
+          const int other = order[i];
+          if (hashes[other] == hashes[index] && child_scores[other] == child_scores[index] && child_positions[other] == child_positions[index]) {
+            duplicate = true;
+            break;
           }
+        }
 
-          Score score = Score(current_score.chain_score + future_score.chain_score,
-                              0,
-                              current_score.heuristic_score + future_score.heuristic_score,
-                              current_score.chain_count);
-          score.chain_count = current_score.chain_count;
+        if (duplicate) {
+          Stats::Add(Stats::DFS_DUPLICATE_COUNT);
+          continue;
+        }
+        order[child_num++] = index;
+      }
+    }
 
-          // 相手よりも大きな連鎖がある場合には、連鎖をして邪魔をする。
-          if (((game.scores[WHITE] < 10 && current_score.chain_count >= 12) || (game.scores[WHITE] >= 10 && current_score.chain_count >= 11)) && ((game.skills[BLACK] + 8 * depth >= 80) || (game.skills[BLACK] + 8 * depth < 80 && current_score.chain_score - 2 * game.ojama_stock[WHITE] >= op_scores[depth].chain_score && current_score.chain_score - 2 * game.ojama_stock[WHITE] >= op_damaged_scores[depth + 2].chain_score)) && current_score.chain_score > (game.scores[BLACK] - game.scores[WHITE])) {
-             score.heuristic_score += 10000000 - 1000 * depth - 110 * current_ojama_stock;
-          }
+    if (depth == 0) {
+      // 前回の反復の最善手、前のターンの読み筋の順に先に探索する
+      int front = 0;
+      for (const Action& first_action : first_actions) {
+        if (first_action.action_type != NORMAL) {
+          continue;
+        }
 
-          if (current_score.chain_count > 5) {
-            score.heuristic_score -= 10;
+        const int index = first_action.column * 4 + first_action.rotate;
+        for (int i = front; i < child_num; i++) {
+          if (order[i] == index) {
+            std::rotate(order + front, order + i, order + i + 1);
+            front++;
+            break;
           }
+        }
+      }
+    }
 
-          if (depth == 0) {
-            for (int y = 3; y < kDANGER_HEIGHT; y++) {
-              for (int x = 0; x < kWIDTH; x++) {
-                if (dfs.position.Get(y, x) == 5) {
-                  score.heuristic_score++;
-                }
-              }
-            }
+    int best_index = -1;  // 同点の場合は、探索した順によらず番号の小さい行動を選ぶ
+    Action best_next_action;
+    bool first_completed = false;
 
-            // 相手がデンジャーライン直下まで積みあがっている場合
-            if (op_scores[0].chain_count == 0 && current_score.chain_score / 2 + game.ojama_stock[BLACK] >= kWIDTH && current_score.chain_score > op_scores[1].GetScoreSum() && game.ojama_stock[BLACK] < kWIDTH && game.positions[BLACK].GetPackedCells(3) != 0ULL) {
-              score.heuristic_score += 700000;
-            }
-          }
+    auto search_func = [this, &mtx, &child_positions, &child_scores, &order, &current_ojama_stock, &depth, &depth_max, &op_damaged_score, &damaged_score, &best_score, &best_action, &best_index, &best_next_action, &first_completed](int index) {
+      const int column = index / 4;
+      const int rotation = index % 4;
 
-          if (dfs.position.GetPackedCells(3) != 0ULL) {
-            score.heuristic_score -= 2000;
-          }
+      DepthFirstSearch dfs(*context);
+      dfs.position = child_positions[index];
+      dfs.ojama_stock = current_ojama_stock;
 
-          for (int danger = 4; danger < 8; danger++) {
-            if (dfs.position.GetPackedCells(danger) != 0ULL) {
-              score.heuristic_score -= 8 - danger;
-            }
-          }
+      const Score& current_score = child_scores[index];
+      const int interrupt_count_before = interrupt_count;
+
+      Score future_score = Score();
+      Action next_action;
+      /**
+       * 連鎖をしていない、または回避できない1連鎖の場合には、1手進めそこでのスコアを用いる。
+       * 連鎖をした場合には、探索を打ち切り、現局面でのスコアを用いる。
+       */
+      if (current_score.chain_count == 0 || (current_score.chain_count == 1 && game.packs[game.turn + depth].IsFlammable())) {
+        future_score = dfs.ChainSearch(depth + 1, depth_max);
+        if (depth + 1 < depth_max) {
+          next_action = dfs.action;
+        }
+      } else {
+        future_score = dfs.ChainSearch(depth_max, depth_max);
+      }
+
+      Score score = Score(current_score.chain_score + future_score.chain_score,
+                          0,
+                          current_score.heuristic_score + future_score.heuristic_score,
+                          current_score.chain_count);
+      score.chain_count = current_score.chain_count;
 
-          {
-            std::lock_guard<std::mutex> lk(mtx);
+      // 相手よりも大きな連鎖がある場合には、連鎖をして邪魔をする。
+      if (((game.scores[WHITE] < 10 && current_score.chain_count >= 12) || (game.scores[WHITE] >= 10 && current_score.chain_count >= 11)) && ((game.skills[BLACK] + 8 * depth >= 80) || (game.skills[BLACK] + 8 * depth < 80 && current_score.chain_score - 2 * game.ojama_stock[WHITE] >= context->op_tables->OpScore(depth).chain_score && current_score.chain_score - 2 * game.ojama_stock[WHITE] >= context->op_tables->OpDamagedScore(depth + 2).chain_score)) && current_score.chain_score > (game.scores[BLACK] - game.scores[WHITE])) {
+         score.heuristic_score += 10000000 - 1000 * depth - 110 * current_ojama_stock;
+      }
 
-            if (score.GetScoreSum() > best_score.GetScoreSum()) {
-              // より良い行動を発見
+      if (current_score.chain_count > 5) {
+        score.heuristic_score -= 10;
+      }
 
-              best_score = score;
-              best_action = Action(NORMAL, column, rotation);
+      if (depth == 0) {
+        for (int y = 3; y < kDANGER_HEIGHT; y++) {
+          for (int x = 0; x < kWIDTH; x++) {
+            if (dfs.position.Get(y, x) == 5) {
+              score.heuristic_score++;
             }
           }
-        };
+        }
 
-        if (parallel) {
-          workers.emplace_back(search_func, column, rotation);
-        } else {
-          search_func(column, rotation);
+        // 相手がデンジャーライン直下まで積みあがっている場合
+        if (context->op_tables->OpScore(0).chain_count == 0 && current_score.chain_score / 2 + game.ojama_stock[BLACK] >= kWIDTH && current_score.chain_score > context->op_tables->OpScore(1).GetScoreSum() && game.ojama_stock[BLACK] < kWIDTH && game.positions[BLACK].GetPackedCells(3) != 0ULL) {
+          score.heuristic_score += 700000;
         }
       }
-    }
 
-    if (parallel) {
-      // 並列化している場合は、全スレッドが探索を終了するのを待つ
-      for (auto& worker : workers) {
-        worker.join();
+      if (dfs.position.GetPackedCells(3) != 0ULL) {
+        score.heuristic_score -= 2000;
+      }
+
+      // ブロックがあるのは、kDANGER_HEIGHT - GetMaxHeight()行目より下
+      for (int danger = std::max(4, kDANGER_HEIGHT - dfs.position.GetMaxHeight()); danger < 8; danger++) {
+        score.heuristic_score -= 8 - danger;
+      }
+
+      // 時間切れで打ち切られた子の結果は使わない
+      if (interrupt_count != interrupt_count_before) {
+        return;
+      }
+
+      {
+        Stats::LockGuard<std::mutex> lk(mtx);
+
+        if (score.GetScoreSum() > best_score.GetScoreSum() || (score.GetScoreSum() == best_score.GetScoreSum() && best_index != -1 && index < best_index)) {
+          // より良い行動を発見
+
+          best_score = score;
+          best_action = Action(NORMAL, column, rotation);
+          best_index = index;
+          best_next_action = next_action;
+        }
+
+        if (index == order[0]) {
+          first_completed = true;
+        }
+      }
+    };
+
+    if (parallel && ThreadPool::ThreadNum() > 1) {
+      // 先頭の子は呼び出し元のスレッドですぐに探索し、残りはワーカーに任せる
+      TaskGroup workers;
+      for (int i = 1; i < child_num; i++) {
+        const int index = order[i];
+        ThreadPool::Submit(workers, [&search_func, index]() { search_func(index); });
+      }
+      if (child_num > 0) {
+        search_func(order[0]);
+      }
+
+      // 全タスクが探索を終了するのを待つ
+      workers.Wait();
+    } else {
+      for (int i = 0; i < child_num; i++) {
+        search_func(order[i]);
       }
     }
 
     // スキルを使用する以外は負けの場合
     if (depth == 0 && best_score.GetScoreSum() == -INF && game.skills[WHITE] >= 80) {
-      this->score = my_skill_score;
+      this->score = context->my_skill_score;
       this->action = Action(SKILL);
+      this->first_completed = true;
+
+      return context->my_skill_score;
+    }
 
-      return my_skill_score;
+    if (depth == 0) {
+      this->next_action = best_next_action;
+      this->first_completed = first_completed;
+    }
+
+    // 打ち切られた子を含む結果は、置換表に残さない
+    if (depth > 0 && !search_interrupted) {
+      transposition_table.Store(key, best_score, best_action);
     }
 
     this->score = best_score;
@@ -418,6 +671,8 @@ struct DepthFirstSearch {
    * 大きな爆発を起こすように探索する。
    */
   Score SkillSearch(int skill_point, int depth, int depth_max, bool parallel = false) {
+    Stats::AddNode(depth);
+
     if (depth >= depth_max) {
       if (skill_point >= 80) {
         Score score = position.Simulate(Pack(), Action(SKILL));
@@ -432,12 +687,13 @@ struct DepthFirstSearch {
         bool five_and_adjacents[kDANGER_HEIGHT][kWIDTH] = { };
         int heights[kWIDTH] = { };
 
-        for (int y = 0; y < kDANGER_HEIGHT; y++) {
-          for (int x = 0; x < kWIDTH; x++) {
-            if (position.Get(y, x) != 0) {
-              heights[x] = y;
-            }
+        for (int x = 0; x < kWIDTH; x++) {
+          // 従来通り、ブロックのある列は最も下の行番号 (kDANGER_HEIGHT - 1) とする
+          heights[x] = (position.GetHeight(x) > 0)? kDANGER_HEIGHT - 1 : 0;
+        }
 
+        for (int y = kDANGER_HEIGHT - position.GetMaxHeight(); y < kDANGER_HEIGHT; y++) {
+          for (int x = 0; x < kWIDTH; x++) {
             if (position.Get(y, x) == 5) {
               five_and_adjacents[y][x] = true;
 
@@ -482,6 +738,11 @@ struct DepthFirstSearch {
       }
     }
 
+    // 時間切れの場合は、この深さの探索を諦める (結果は呼び出し元で捨てられる)
+    if (depth > 0 && IsInterrupted(depth_max)) {
+      return Score(0, 0, -INF + depth, 0);
+    }
+
     Score op_damaged_score, op_skill_score;
     if (depth == 0) {
       {
@@ -518,7 +779,7 @@ struct DepthFirstSearch {
 
       if (depth == 0) {
         // 今SKILLを打たないと、打てなくなってしまう
-        if (skill_point < 92 && op_scores[0].chain_count >= 3 && position.GetPackedCells(6) != 0ULL) {
+        if (skill_point < 92 && context->op_tables->OpScore(0).chain_count >= 3 && position.GetPackedCells(6) != 0ULL) {
           best_score.heuristic_score += 300000;
         }
       }
@@ -527,8 +788,8 @@ struct DepthFirstSearch {
 
     std::mutex mtx;
 
-    auto search_func = [&mtx, &skill_point, &current_position, &current_ojama_stock, &depth, &depth_max, &best_score, &best_action](int column, int rotate){
-      DepthFirstSearch dfs;
+    auto search_func = [this, &mtx, &skill_point, &current_position, &current_ojama_stock, &depth, &depth_max, &best_score, &best_action](int column, int rotate){
+      DepthFirstSearch dfs(*context);
       dfs.position = current_position;
       dfs.ojama_stock = current_ojama_stock;
 
@@ -542,10 +803,8 @@ struct DepthFirstSearch {
       Score score = dfs.SkillSearch(next_skill_point, depth + 1, depth_max);
       score.chain_score = 0;  // 連鎖による得点は評価しない
 
-      for (int danger = 4; danger < kDANGER_HEIGHT; danger++) {
-        if (dfs.position.GetPackedCells(danger) != 0ULL) {
-          score.heuristic_score -= kDANGER_HEIGHT - danger;
-        }
+      for (int danger = std::max(4, kDANGER_HEIGHT - dfs.position.GetMaxHeight()); danger < kDANGER_HEIGHT; danger++) {
+        score.heuristic_score -= kDANGER_HEIGHT - danger;
       }
 
       if (skill_point <= 92) {
@@ -559,7 +818,7 @@ struct DepthFirstSearch {
       }
 
       {
-        std::lock_guard<std::mutex> lk(mtx);
+        Stats::LockGuard<std::mutex> lk(mtx);
 
         if (score.GetScoreSum() > best_score.GetScoreSum()) {
           best_score = score;
@@ -569,12 +828,17 @@ struct DepthFirstSearch {
       }
     };
 
-    std::vector<std::thread> workers;
+    TaskGroup workers;
+    const uint64_t unique_actions = game.packs[game.turn + depth].GetUniqueActions();
 
     for (int column = 0; column < 9; column++) {
       for (int rotate = 0; rotate < 4; rotate++) {
+        if (((unique_actions >> (column * 4 + rotate)) & 1) == 0) {
+          continue;
+        }
+
         if (parallel) {
-          workers.emplace_back(search_func, column, rotate);
+          ThreadPool::Submit(workers, [&search_func, column, rotate]() { search_func(column, rotate); });
         } else {
           search_func(column, rotate);
         }
@@ -582,9 +846,7 @@ struct DepthFirstSearch {
     }
 
     if (parallel) {
-      for (auto& worker : workers) {
-        worker.join();
-      }
+      workers.Wait();
     }
 
     this->score = best_score;
@@ -593,6 +855,42 @@ struct DepthFirstSearch {
   }
 };
 
+/**
+ * ビームサーチの1状態。
+ * 行動の手順は保持せず、親の番号と最後の行動のみを保持する。
+ * 手順は探索終了後に親をたどることで復元する。
+ */
+struct BeamNode {
+  Position position;
+  Score score;
+  int parent;  // 1つ前の深さでの親の番号
+  uint8_t action;  // 最後の行動 (column * 4 + rotate)
+
+  BeamNode(): score(Score()), parent(-1), action(0) { }
+
+  Action GetAction() const {
+    return Action(NORMAL, action / 4, action % 4);
+  }
+};
+
+/**
+ * 手順の復元に用いる、親の番号と行動の組。
+ */
+struct BeamTrace {
+  int parent;
+  uint8_t action;
+};
+
+/**
+ * 連鎖を発火した状態と、その発火までに必要な手数。
+ */
+struct FlammableState {
+  BeamNode node;
+  int require_turn;
+
+  FlammableState(): require_turn(INF) { }
+};
+
 /**
  * ビームサーチによる探索。
  */
@@ -603,159 +901,394 @@ struct BeamSearch {
   Score score;
   Action action_sequence[kSEARCH_DEPTH + 2];
   int require_turn;
-  std::vector<BeamSearch> states, next_states;
-
-  bool operator>(const BeamSearch& beam_search) const {
-    return score.GetScoreSum() > beam_search.score.GetScoreSum();
-  }
 
-  BeamSearch(): score(Score()), require_turn(INF) {
+  std::vector<BeamNode> states;  // 現在の深さで展開する状態 (評価値の降順)
+  std::vector<BeamTrace> traces[kSEARCH_DEPTH + 1];  // traces[turn][i]: 深さturnでのstates[i]の親と行動
 
-  }
+  // 展開した子の格納先
+  // 親ごとに展開する行動の数だけ場所を確保しておき、親indexの子は children[index * action_num] から child_counts[index]個並べる。
+  // 各親は1つのスレッドのみが展開するので、ロックせずに書き込める。
+  // 深さやターンをまたいで使い回し、足りなくなった場合のみ広げる。
+  std::vector<BeamNode> children;
+  std::vector<int> child_counts;
 
-  void Init() {
-    states.reserve(100000 * 36);
-    next_states.reserve(100000 * 36);
-  }
+  std::vector<FlammableState> shard_bests;  // スレッドごとの最善の発火
 
-  void Start(int target_chain_count, int search_width = 5000, bool use_sides = true) {
-    std::mutex mtx;
+  // 次の深さへ残す状態を選ぶための、(評価値, 番号)の組
+  std::vector<std::pair<int, int>> selection_keys;
 
-    BeamSearch flammable_best;
+  // 同じ深さに現れた同一局面を取り除くための集合
+  TranspositionSet transposition_set;
+  std::vector<int64_t> shard_generated_counts, shard_duplicate_counts;
+  int64_t generated_count, duplicate_count;  // 生成した状態の数と、そのうち重複していた数
 
+  int searched_depth;  // 展開した深さ
+  int max_width;  // 保持した状態の数の最大値
+  int reused_depth;  // 前回の探索から引き継いだ深さ
+  int ojama_rows;  // お邪魔が降る段数 (深さ0から順に、各ターンの始めに1段ずつ降るものとして探索する)
+  std::atomic<bool> timeout;  // 時間切れで打ち切ったかどうか
 
-    Stopwatch sw;
-    sw.Start();
+  FlammableState flammable_best;  // これまでに見つけた最善の発火
 
-    for (int i = 0; i < kSEARCH_DEPTH + 2; i++) {
-      action_sequence[i] = Action();
-    }
+  // 前回の探索を引き継ぐための情報
+  // 前回の探索の後に実際に指した手をたどり、その先の状態だけを残して探索を続ける
+  int base_turn;  // 前回の探索を始めたターン (-1の場合は引き継げない)
+  Position base_position;  // 前回の探索を始めた局面
+  Pack base_packs[kSEARCH_DEPTH + 1];  // 前回の探索で用いたpack
+  int base_target_chain_count;
+  bool base_use_sides;
+  Action played_actions[kSEARCH_DEPTH];  // base_turnから実際に指した手
 
-    {
-      states.clear();
-      flammable_best = BeamSearch();
+  static inline const int kCHUNK_SIZE = 16;  // 1度に取り出す親の数
 
-      // rootを登録
-      BeamSearch beam_search;
-      beam_search.position = position;
-      states.push_back(beam_search);
-    }
+  BeamSearch(): score(Score()), require_turn(INF), generated_count(0), duplicate_count(0), searched_depth(0), max_width(0), reused_depth(0), ojama_rows(0), timeout(false), base_turn(-1), base_target_chain_count(0), base_use_sides(false) {
 
-    for (int turn = 0; turn < kSEARCH_DEPTH; turn++) {
-      if (turn > kSEARCH_DEPTH - 4) {
-        search_width = 5000;
-      }
+  }
 
-      next_states.clear();
+  void Init() {
+    states.reserve(100000);
+    selection_keys.reserve(100000 * 36);
+  }
 
-      // 目標連鎖数を最短で見つけたいため、
-      // 目標連鎖数を達成している場合には、それ以上深く探索する必要がない
-      if (flammable_best.score.chain_count >= target_chain_count) {
-        break;
+  /**
+   * 連鎖を発火したnextが、これまでの最善であるbestよりも良いかどうかを返す。
+   *
+   * 無理に連鎖を大きくしにいかない。
+   * 狙った連鎖量をできるだけ早く撃つことを目指す。
+   */
+  static bool IsBetterFlammable(const FlammableState& next, const FlammableState& best, int target_chain_count) {
+    if (next.node.score.chain_count >= target_chain_count && best.node.score.chain_count >= target_chain_count) {
+      if (next.require_turn < best.require_turn) {
+        return true;
+      } else if (next.require_turn == best.require_turn) {
+        if (next.node.score.chain_count > best.node.score.chain_count) {
+          return true;
+        } else if (next.node.score.chain_count == best.node.score.chain_count) {
+          if (next.node.score.heuristic_score > best.node.score.heuristic_score) {
+            return true;
+          }
+        }
+      }
+    } else {
+      if (next.node.score.chain_count > best.node.score.chain_count) {
+        return true;
+      } else if (next.node.score.chain_count == best.node.score.chain_count) {
+        if (next.require_turn < best.require_turn) {
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  /**
+   * parent_num個の親から展開した子の中から評価値の高いものをsearch_width個選び、statesに格納する。
+   * nth_elementで上位を選んだ後、選ばれたものだけを評価値の降順に並べる。
+   */
+  void SelectStates(int turn, int search_width, int parent_num, int action_num) {
+    selection_keys.clear();
+
+    for (int index = 0; index < parent_num; index++) {
+      const int offset = index * action_num;
+      for (int i = 0; i < child_counts[index]; i++) {
+        selection_keys.emplace_back(children[offset + i].score.GetScoreSum(), offset + i);
+      }
+    }
+
+    auto greater = [](const std::pair<int, int>& lhs, const std::pair<int, int>& rhs) {
+      return lhs.first > rhs.first;
+    };
+
+    int select_size = std::min((int)selection_keys.size(), search_width);
+    std::nth_element(selection_keys.begin(), selection_keys.begin() + select_size, selection_keys.end(), greater);
+    std::sort(selection_keys.begin(), selection_keys.begin() + select_size, greater);
+
+    states.clear();
+    traces[turn].clear();
+    for (int i = 0; i < select_size; i++) {
+      const BeamNode& node = children[selection_keys[i].second];
+      states.push_back(node);
+      traces[turn].push_back(BeamTrace{ node.parent, node.action });
+    }
+  }
+
+  /**
+   * 実際に指した手を記録する。
+   */
+  void Record(int turn, const Action& action) {
+    const int index = turn - base_turn;
+    if (base_turn >= 0 && index >= 0 && index < kSEARCH_DEPTH) {
+      played_actions[index] = action;
+    }
+  }
+
+  /**
+   * 前回の探索のうち、実際に指した手の先にある状態だけを残し、現局面を根とするように付け替える。
+   * 付け替えた場合は残した状態の深さを、引き継げない場合は0を返す。
+   */
+  int Reroot(int target_chain_count, bool use_sides) {
+    // 先読みで同じターンの探索を済ませている場合は、played_numが0となり全ての状態を引き継ぐ
+    const int played_num = game.turn - base_turn;
+    if (base_turn < 0 || played_num < 0 || played_num >= searched_depth) {
+      return 0;
+    }
+    if (target_chain_count != base_target_chain_count || use_sides != base_use_sides) {
+      return 0;
+    }
+    // 指した手をたどる際にお邪魔の落下は再現しないので、お邪魔が降る想定の探索は引き継がない
+    if (ojama_rows > 0) {
+      return 0;
+    }
+    for (int turn = 0; turn <= searched_depth; turn++) {
+      if (!(game.packs[base_turn + turn] == base_packs[turn])) {
+        return 0;
+      }
+    }
+
+    // 指した手に対応する状態を、各深さでたどる
+    // お邪魔が降ってきた場合などは、指した手で現局面に到達しないので引き継げない
+    Position expected = base_position;
+    int index = 0;
+    for (int turn = 0; turn < played_num; turn++) {
+      const Action& action = played_actions[turn];
+      if (action.action_type != NORMAL) {
+        return 0;
+      }
+      expected.Simulate(game.packs[base_turn + turn], action);
+
+      const uint8_t code = action.column * 4 + action.rotate;
+      int next_index = -1;
+      for (int i = 0; i < (int)traces[turn + 1].size(); i++) {
+        if (traces[turn + 1][i].parent == index && traces[turn + 1][i].action == code) {
+          next_index = i;
+          break;
+        }
+      }
+      if (next_index == -1) {
+        return 0;
+      }
+      index = next_index;
+    }
+    if (!(expected == position)) {
+      return 0;
+    }
+
+    // 深さturnのi番目の状態が、指した手の先にあるかどうか
+    auto is_descendant = [this, played_num, index](int turn, int i) {
+      for (; turn > played_num; turn--) {
+        i = traces[turn][i].parent;
+      }
+      return i == index;
+    };
+
+    // 末端の状態は、評価値の降順を保ったまま残す
+    int kept = 0;
+    for (int i = 0; i < (int)states.size(); i++) {
+      if (is_descendant(searched_depth, i)) {
+        states[kept] = states[i];
+        traces[searched_depth][kept] = traces[searched_depth][i];
+        kept++;
+      }
+    }
+    states.resize(kept);
+    traces[searched_depth].resize(kept);
+    if (kept == 0) {
+      return 0;
+    }
+
+    if (flammable_best.require_turn != INF && flammable_best.require_turn >= played_num && is_descendant(flammable_best.require_turn, flammable_best.node.parent)) {
+      flammable_best.require_turn -= played_num;
+    } else {
+      flammable_best = FlammableState();
+    }
+
+    // 深さをplayed_numだけずらす
+    // 手順の復元では深さ1の親を参照しないので、番号を振り直す必要はない
+    const int depth = searched_depth - played_num;
+    for (int turn = 1; turn <= depth; turn++) {
+      std::swap(traces[turn], traces[turn + played_num]);
+    }
+    for (int turn = depth + 1; turn <= searched_depth; turn++) {
+      traces[turn].clear();
+    }
+
+    return depth;
+  }
+
+  /**
+   * 探索を行う。
+   * 打ち切りにはdeadlineを用いるので、呼び出し元で期限を設定しておくこと。
+   */
+  void Start(int target_chain_count, int search_width = 5000, bool use_sides = true) {
+#ifdef SERVER
+    const int shard_num = 1;
+#else
+    const int shard_num = ThreadPool::ThreadNum();
+#endif
+    shard_bests.resize(shard_num);
+    shard_generated_counts.assign(shard_num, 0);
+    shard_duplicate_counts.assign(shard_num, 0);
+
+    transposition_set.Reserve((int64_t)search_width * 36);
+
+    for (int i = 0; i < kSEARCH_DEPTH + 2; i++) {
+      action_sequence[i] = Action();
+    }
+
+    reused_depth = Reroot(target_chain_count, use_sides);
+    searched_depth = reused_depth;
+    max_width = std::max(1, (int)states.size());
+    timeout = false;
+
+    if (reused_depth == 0) {
+      states.clear();
+      traces[0].clear();
+      flammable_best = FlammableState();
+
+      // rootを登録
+      BeamNode root;
+      root.position = position;
+      states.push_back(root);
+      traces[0].push_back(BeamTrace{ -1, 0 });
+    }
+
+    base_turn = game.turn;
+    base_position = position;
+    for (int turn = 0; turn <= kSEARCH_DEPTH; turn++) {
+      base_packs[turn] = game.packs[game.turn + turn];
+    }
+    base_target_chain_count = target_chain_count;
+    base_use_sides = use_sides;
+    for (int turn = 0; turn < kSEARCH_DEPTH; turn++) {
+      played_actions[turn] = Action();
+    }
+
+    for (int turn = reused_depth; turn < kSEARCH_DEPTH; turn++) {
+      // 目標連鎖数を最短で見つけたいため、
+      // 目標連鎖数を達成している場合には、それ以上深く探索する必要がない
+      if (flammable_best.node.score.chain_count >= target_chain_count) {
+        break;
       }
 
       if (states.size() == 0) {
         break;
       }
 
-      // search_widthよりも保持している状態の個数が少ないときに、バグが発生しないように注意する
-      int sort_size = std::min((int)states.size(), search_width);
-      std::partial_sort(states.begin(), states.begin() + sort_size, states.end(), std::greater<BeamSearch>());
+      // 親は先頭からkCHUNK_SIZE個ずつ取り出し、子は各スレッドの格納先に書き込む
+      const int parent_num = states.size();
+      std::atomic<int> counter(0);
+
+      // 展開する行動は全ての親で共通なので、先に決めておく
+      // 候補を絞ってから重複を除くことで、除いた列の行動の代わりに同じ局面になる行動が残るようにする
+      uint64_t candidates = 0;
+      for (int column = 0; column < 9; column++) {
+        if (!use_sides) {
+          if (column == 0) {
+            continue;
+          }
+        }
 
-      int counter = 0;
+        // 最初の探索では、真ん中に置くことしか考えない
+        if (game.turn == 0 && turn == 0 && column != 4) {
+          continue;
+        }
 
-      auto search_func = [this, &mtx, &sw, &target_chain_count, &counter, &search_width, &use_sides, turn, &flammable_best]() {
-        while(true) {
-          BeamSearch beam_search;
-          {
-            std::lock_guard<std::mutex> lk(mtx);
-            if (counter == (int)states.size()) {
-              break;
-            }
+        candidates |= (0b1111ULL << (column * 4));
+      }
+      const uint64_t unique_actions = game.packs[game.turn + turn].GetUniqueActions(candidates);
+      const int action_num = __builtin_popcountll(unique_actions);
 
-            if (counter == search_width) {
-              break;
-            }
+      // 子の格納先を用意する
+      if ((int64_t)children.size() < (int64_t)parent_num * action_num) {
+        children.resize((int64_t)parent_num * action_num);
+      }
+      child_counts.assign(parent_num, 0);
 
-            beam_search = states[counter];
-            counter++;
-          }
+      auto search_func = [this, &target_chain_count, &counter, &parent_num, unique_actions, action_num, turn](int shard) {
+        FlammableState& local_best = shard_bests[shard];
+        int64_t& generated = shard_generated_counts[shard];
+        int64_t& duplicate = shard_duplicate_counts[shard];
 
-          for (int column = 0; column < 9; column++) {
-            if (!use_sides) {
-              if (column == 0) {
-                continue;
-              }
-            }
+        while (true) {
+          const int begin = counter.fetch_add(kCHUNK_SIZE);
+          if (begin >= parent_num) {
+            break;
+          }
 
-            // 最初の探索では、真ん中に置くことしか考えない
-            if (game.turn == 0 && turn == 0 && column != 4) {
-              continue;
+          const int end = std::min(begin + kCHUNK_SIZE, parent_num);
+          for (int index = begin; index < end; index++) {
+            const BeamNode& beam_node = states[index];
+            BeamNode* slots = &children[(int64_t)index * action_num];
+            int& child_count = child_counts[index];
+
+            // お邪魔が降るターンは、降った後の局面に置く
+            Position damaged_position;
+            const Position* parent_position = &beam_node.position;
+            if (turn < ojama_rows) {
+              damaged_position = beam_node.position;
+              damaged_position.Attacked();
+              parent_position = &damaged_position;
             }
 
-            for (int rotate = 0; rotate < 4; rotate++) {
-              // 思考時間が18秒超えたら打ち切り
-              if (sw.Elapsed() > 18000) {
+            const Pack& pack = game.packs[game.turn + turn];
+            for (uint64_t mask = unique_actions; mask != 0; mask &= mask - 1) {
+              // 期限を過ぎたら打ち切り
+              if (deadline.IsExpired()) {
+                timeout = true;
                 return;
               }
 
-              Action action = Action(NORMAL, column, rotate);
-              BeamSearch next = beam_search;
+              const int action_index = __builtin_ctzll(mask);
+              const Action action(NORMAL, action_index / 4, action_index % 4);
 
-              Score current_score = next.position.Simulate(game.packs[game.turn + turn], action);
+              // 子は格納先に直接書き込み、残さない場合はchild_countを増やさずに次の子で上書きする
+              BeamNode& next = slots[child_count];
+              next.position = *parent_position;
+              next.score = beam_node.score;
+
+              Score current_score = next.position.Simulate(pack, action);
 
               if (next.position.GetPackedCells(3) != 0ULL) {
                 continue;
               }
 
-              next.action_sequence[turn] = action;
+              next.parent = index;
+              next.action = action.column * 4 + action.rotate;
 
               if (current_score.chain_count > 1) {
-                next.score = current_score;
-                next.require_turn = turn;
+                FlammableState flammable;
+                flammable.node = next;
+                flammable.node.score = current_score;
+                flammable.require_turn = turn;
 
                 // 目標連鎖数に達した場合は、連鎖以外のものを評価
-                if (next.score.chain_count >= target_chain_count) {
+                if (flammable.node.score.chain_count >= target_chain_count) {
                   // ブロックの数を評価
                   for (int y = 5; y < kDANGER_HEIGHT; y++) {
                     for (int x = 0; x < kWIDTH; x++) {
                       int num = next.position.Get(y, x);
                       if (num != 0 && num != 11) {
-                        next.score.heuristic_score++;
+                        flammable.node.score.heuristic_score++;
                       }
                     }
                   }
                 }
 
-                {
-                  //
-                  // 無理に連鎖を大きくしにいかない。
-                  // 狙った連鎖量をできるだけ早く撃つことを目指す。
-                  //
-                  std::lock_guard<std::mutex> lk(mtx);
-                  if (next.score.chain_count >= target_chain_count && flammable_best.score.chain_count >= target_chain_count) {
-                    if (turn < flammable_best.require_turn) {
-                      flammable_best = next;
-                    } else if (turn == flammable_best.require_turn) {
-                      if (next.score.chain_count > flammable_best.score.chain_count) {
-                        flammable_best = next;
-                      } else if (next.score.chain_count == flammable_best.score.chain_count) {
-                        if (next.score.heuristic_score > flammable_best.score.heuristic_score) {
-                          flammable_best = next;
-                        }
-                      }
-                    }
-                  } else {
-                    if (next.score.chain_count > flammable_best.score.chain_count) {
-                      flammable_best = next;
-                    } else if (next.score.chain_count == flammable_best.score.chain_count) {
-                      if (next.require_turn < flammable_best.require_turn) {
-                        flammable_best = next;
-                      }
-                    }
-                  }
+                // スレッドごとの最善を更新し、深さごとの探索終了時にまとめる
+                if (IsBetterFlammable(flammable, local_best, target_chain_count)) {
+                  local_best = flammable;
                 }
               } else {
+                // 異なる手順で同じ局面に到達している場合は、評価せずに取り除く
+                generated++;
+                Stats::Add(Stats::BEAM_STATE_COUNT);
+                if (!transposition_set.Insert(next.position.Hash())) {
+                  duplicate++;
+                  Stats::Add(Stats::BEAM_DUPLICATE_COUNT);
+                  continue;
+                }
+
                 Point erase_point;
                 if (game.turn == 0) {
                   if (next.position.GetPackedCells(6) == 0ULL) {
@@ -795,45 +1328,78 @@ struct BeamSearch {
                   next.score.heuristic_score -= 1000;
                 }
 
-                for (int danger = 4; danger < 10; danger++) {
-                  // あまり高く積まない方が良い
-                  if (next.position.GetPackedCells(danger) != 0ULL) {
-                    next.score.heuristic_score -= 5;
-                  }
+                // あまり高く積まない方が良い
+                const int danger_top = std::max(4, kDANGER_HEIGHT - next.position.GetMaxHeight());
+                if (danger_top < 10) {
+                  next.score.heuristic_score -= 5 * (10 - danger_top);
                 }
 
-                {
-                  std::lock_guard<std::mutex> lk(mtx);
-                  next_states.push_back(next);
-                }
+                child_count++;
               }
             }
           }
         }
       };
 
+      for (int shard = 0; shard < shard_num; shard++) {
+        shard_bests[shard] = FlammableState();
+      }
+      transposition_set.NextGeneration();
+
 #ifdef SERVER
       // 1スレッドで探索
-      search_func();
+      search_func(0);
 #else
       // 複数スレッドで探索
-      const int kWORKER_NUM = 16;
-      std::vector<std::thread> workers;
-      for (int worker_count = 0; worker_count < kWORKER_NUM; worker_count++) {
-        workers.emplace_back(search_func);
-      }
-      for (auto& worker : workers) {
-        worker.join();
+      TaskGroup workers;
+      for (int shard = 0; shard < shard_num; shard++) {
+        ThreadPool::Submit(workers, [&search_func, shard]() { search_func(shard); });
       }
+      workers.Wait();
 #endif
 
-      states.swap(next_states);
+      // スレッドごとの最善をまとめる
+      for (int shard = 0; shard < shard_num; shard++) {
+        if (IsBetterFlammable(shard_bests[shard], flammable_best, target_chain_count)) {
+          flammable_best = shard_bests[shard];
+        }
+      }
+
+      // 次の深さで展開する状態を選ぶ (終盤はビーム幅を狭める)
+      if (turn + 1 > kSEARCH_DEPTH - 4) {
+        search_width = 5000;
+      }
+      SelectStates(turn + 1, search_width, parent_num, action_num);
+      Stats::Add(Stats::BEAM_PRUNED_COUNT, selection_keys.size() - states.size());
+
+      searched_depth = turn + 1;
+      max_width = std::max(max_width, (int)states.size());
+
+      // 時間切れの場合は、途中まで展開した状態を末端として残す (次の探索で引き継げるように)
+      if (timeout) {
+        break;
+      }
+    }
+
+    generated_count = 0;
+    duplicate_count = 0;
+    for (int shard = 0; shard < shard_num; shard++) {
+      generated_count += shard_generated_counts[shard];
+      duplicate_count += shard_duplicate_counts[shard];
     }
 
-    score = flammable_best.score;
+    score = flammable_best.node.score;
     require_turn = flammable_best.require_turn;
-    for (int i = 0; flammable_best.action_sequence[i].action_type != NO_ACTION_TYPE; i++) {
-      action_sequence[i] = flammable_best.action_sequence[i];
+
+    if (require_turn != INF) {
+      // 親をたどって手順を復元する
+      action_sequence[require_turn] = flammable_best.node.GetAction();
+      int index = flammable_best.node.parent;
+      for (int turn = require_turn; turn > 0; turn--) {
+        const BeamTrace& trace = traces[turn][index];
+        action_sequence[turn - 1] = Action(NORMAL, trace.action / 4, trace.action % 4);
+        index = trace.parent;
+      }
     }
   }
 };
@@ -842,103 +1408,285 @@ BeamSearch beam_search;
 
 }  // namespace
 
-void Think::Init() {
+void Think::Init(int thread_num) {
+#ifdef SERVER
+  thread_num = 1;
+#endif
+  ThreadPool::Init(thread_num);
+  transposition_table.Resize(kTRANSPOSITION_TABLE_BITS);
   beam_search.Init();
 }
 
-Action Think::Start(const Game& g) {
+namespace {
+
+Think::Statistics statistics;
+
+// ターンをまたいで保持する、Search()の状態
+bool beam_search_flag = true;  // 次にビームサーチを行うかどうか
+std::queue<Action> action_queue;  // ビームサーチで求めた手順のうち、そのまま指すもの
+int planned_ojama_rows = 0;  // action_queueの手順が想定している、次に指すターンのお邪魔の段数
+Score planned_score;  // action_queueの手順の先で発火する連鎖
+Mode mode = CHAIN_MODE;
+
+#ifndef SERVER
+// 前のターンのChainSearch()で、最善手の次に指すと読んだ手
+Action predicted_action;
+int predicted_turn = -1;
+
+// 先読み
+const double kPONDER_TIME_LIMIT = 3600 * 1000;  // 先読みの期限 (StopPondering()で打ち切るまで続ける)
+const int kPONDER_OJAMA_ROW_NUM = 3;  // 次のターンに降ってくるお邪魔の段数として、0段からこの段数未満までを想定する
+const int kSPECULATIVE_SEARCH_WIDTH = 10000;  // お邪魔が降る場合を想定したビームサーチの幅 (使われるかわからないので狭くする)
+
+// speculative_beam_searches[rows]: 次のターンにお邪魔がrows段降る場合を想定したビームサーチ
+// (speculative_beam_searches[0]は使わない。降らない場合はbeam_searchの続きを進める)
+BeamSearch speculative_beam_searches[kPONDER_OJAMA_ROW_NUM];
+
+std::thread ponder_thread;
+std::atomic<bool> ponder_stopped(false);
+
+/**
+ * 深さkMIN_ITERATION_DEPTHから順に、deadlineまでsearch(depth_max)で探索を深くしていく。
+ * 次の深さを探索し終えられそうにない場合は始めず、途中で時間切れになった深さの結果は捨てる。
+ * dfsには、最後に探索し終えた深さの結果が残る。
+ *
+ * partialがtrueの場合、各深さでは前回の最善手を最初に探索し (ChainSearch())、
+ * それを探索し終えていれば、時間切れになった深さの結果も探索し終えた子の中での最善として用いる。
+ * そのため、次の深さの探索を全て終えられる見込みがなくても、一部を探索できる見込みがあれば始める。
+ */
+template <class SearchFunc>
+void IterativeSearch(DepthFirstSearch& dfs, SearchFunc search, bool partial) {
+  search_interrupted = false;
+
+  const int depth_max = (fixed_search_depth > 0)? fixed_search_depth : kMAX_SEARCH_DEPTH;
+  double prev_elapsed = 0, last_elapsed = 0;
+
+  for (int depth = kMIN_ITERATION_DEPTH; depth <= depth_max; depth++) {
+    if (fixed_search_depth == 0 && depth > kMIN_SEARCH_DEPTH) {
+      // 直前の2つの深さの探索時間の比から、次の深さの探索時間を見積もる
+      double growth = (prev_elapsed > 0)? std::max(kMIN_DEPTH_GROWTH, last_elapsed / prev_elapsed) : kMIN_DEPTH_GROWTH;
+      double required = last_elapsed * growth * (partial? kPARTIAL_SEARCH_RATIO : 1.0);
+      if (required > deadline.Remaining()) {
+        statistics.search_timeout = true;
+        break;
+      }
+    }
+
+    const Score prev_score = dfs.score;
+    const Action prev_action = dfs.action;
+    const Action prev_next_action = dfs.next_action;
+
+    dfs.first_actions[0] = (depth > kMIN_ITERATION_DEPTH)? dfs.action : Action();
+    dfs.first_completed = false;
+
+    Stopwatch sw;
+    sw.Start();
+    search(depth);
+
+    if (search_interrupted) {
+      statistics.search_timeout = true;
+
+      if (partial && dfs.first_completed) {
+        statistics.search_depth = depth;
+      } else {
+        dfs.score = prev_score;
+        dfs.action = prev_action;
+        dfs.next_action = prev_next_action;
+      }
+      break;
+    }
+
+    statistics.search_depth = depth;
+    prev_elapsed = last_elapsed;
+    last_elapsed = sw.Elapsed();
+  }
+}
+#endif
+
+/**
+ * 現在のgameの自分の局面から、searchでビームサーチを行う。
+ * ojama_rowsは、このターンから降ってくるお邪魔の段数。
+ * 期限は呼び出し元でdeadlineに設定しておくこと。
+ */
+void RunBeamSearch(BeamSearch& search = beam_search, int ojama_rows = 0) {
+  search.position = game.positions[WHITE];
+  search.ojama_rows = ojama_rows;
+  int target_chain_count = (game.turn == 0)? 99 : 12;  // 0 ターン目はできるだけ大きい連鎖、1ターン目以降は12連鎖を目指す
+
+  // ビーム幅
+#ifdef SERVER
+  int search_width = (game.turn == 0)? 6000 : 6000;
+#else
+  int search_width = (game.turn == 0)? 30000 : (ojama_rows > 0)? kSPECULATIVE_SEARCH_WIDTH : 50000;
+#endif
+
+  bool use_sides = (game.turn > 0);  // 0ターン目は一番端の列を使わない
+
+  search.Start(target_chain_count, search_width, use_sides);  // 探索開始
+}
+
+/**
+ * ビームサーチの結果が、連鎖を組む手順として使えるかどうか。
+ * 11連鎖を作れなかった場合や、連鎖数 < ターン数の場合には使えない。
+ */
+bool IsUsablePlan(const BeamSearch& search) {
+  return search.score.chain_count >= 11 || search.score.chain_count >= search.require_turn;
+}
+
+/**
+ * ビームサーチで求めた手順を、そのまま指すものとしてaction_queueに登録する。
+ * ojama_rowsは、その探索で想定したお邪魔の段数。
+ */
+void QueueBeamPlan(const BeamSearch& search, int ojama_rows) {
+  // 過去の探索結果が格納されている場合は、消去しておく
+  while (!action_queue.empty()) {
+    action_queue.pop();
+  }
+
+  /**
+   *  何手先まで探索結果を保存するか
+   *   - 0ターン目は発火直前まで保存
+   *   - それ以降は、発火直前 - 3 ターンまで保存
+   *       探索結果が保持されていない場合は、深さ4の全探索を行うため、
+   *       この発火が全探索で発見される
+   * 連鎖を大きくすることよりも、途中で相手を攻撃する方が有力な場合があるため、
+   * 最後まで登録しない。
+   */
+#ifdef SERVER
+  int cache_depth = (game.turn == 0)? search.require_turn - 2 : std::min(7, search.require_turn - 2);
+#else
+  int cache_depth = (game.turn == 0)? search.require_turn - 3 : std::min(7, search.require_turn - 3);
+#endif
+  for (int i = 0; i < cache_depth && i < search.require_turn; i++) {
+    action_queue.push(search.action_sequence[i]);
+  }
+
+  planned_ojama_rows = ojama_rows;
+  planned_score = search.score;
+}
+
+#ifndef SERVER
+/**
+ * お邪魔が降ってきた場合に、先読みでその段数を想定して求めた手順があれば、action_queueに登録する。
+ */
+void AdoptSpeculativePlan() {
+  const int rows = game.ojama_stock[WHITE] / kWIDTH;
+  if (rows >= kPONDER_OJAMA_ROW_NUM) {
+    return;
+  }
+
+  const BeamSearch& search = speculative_beam_searches[rows];
+  if (search.base_turn != game.turn || !(search.base_position == game.positions[WHITE]) || search.require_turn == INF || !IsUsablePlan(search)) {
+    return;
+  }
+
+  std::cerr << "speculative plan: " << rows << " ojama rows, " << search.score.chain_count << " chain in " << search.require_turn << " turn" << std::endl;
+  QueueBeamPlan(search, rows);
+  beam_search_flag = false;
+}
+#endif
+
+Action Search(const Game& g) {
   Stopwatch sw;
   sw.Start();
 
   game = g;
-  static bool beam_search_flag = true;
-  static std::queue<Action> action_queue;
-  static Mode mode = CHAIN_MODE;
+  search_generation++;
 
   /**
    * 連鎖モード &&
    * ビームサーチフラグ オン &&
-   * 残り時間が40秒以上 &&
+   * ビームサーチに使える時間がある (残り時間が40秒より多い) &&
    * お邪魔が降ってこない &&
    * ブロックが上から5段目以上にない &&
    *
    * その場合には、ビームサーチで目標連鎖数だけの連鎖ができるか探索。
    */
-  if (mode == CHAIN_MODE && beam_search_flag && game.remain_time[WHITE] > 40 * 1000 && game.ojama_stock[WHITE] < kWIDTH && game.positions[WHITE].GetPackedCells(5) == 0ULL) {
+  const double beam_budget = TimeManager::BeamBudget(game);
+  if (mode == CHAIN_MODE && beam_search_flag && beam_budget > 0 && game.ojama_stock[WHITE] < kWIDTH && game.positions[WHITE].GetPackedCells(5) == 0ULL) {
     std::cerr << "----- BEAM SEARCH -----" << std::endl;
-    beam_search.position = game.positions[WHITE];
-    int target_chain_count = (game.turn == 0)? 99 : 12;  // 0 ターン目はできるだけ大きい連鎖、1ターン目以降は12連鎖を目指す
+    deadline.Start(beam_budget);
+    RunBeamSearch();
 
-    // ビーム幅
-#ifdef SERVER
-    int search_width = (game.turn == 0)? 6000 : 6000;
-#else
-    int search_width = (game.turn == 0)? 30000 : 50000;
-#endif
-
-    bool use_sides = (game.turn > 0);  // 0ターン目は一番端の列を使わない
-
-    beam_search.Start(target_chain_count, search_width, use_sides);  // 探索開始
+    statistics.beam_elapsed = sw.Elapsed();
+    statistics.beam_depth = beam_search.searched_depth;
+    statistics.beam_width = beam_search.max_width;
+    statistics.beam_timeout = beam_search.timeout;
+    statistics.beam_reused_depth = beam_search.reused_depth;
 
+    if (beam_search.reused_depth > 0) {
+      std::cerr << "reused: depth " << beam_search.reused_depth << " (" << beam_search.states.size() << " states)" << std::endl;
+    }
     std::cerr << "expected chain: " << beam_search.score.chain_count << " in " << beam_search.require_turn << " turn [" << (int)sw.Elapsed() << " ms]" << std::endl;
-    std::cerr << "-----------------------" << std::endl;
-
-    // 過去の探索結果が格納されている場合は、消去しておく
-    while (!action_queue.empty()) {
-      action_queue.pop();
+    std::cerr << "duplicate: " << beam_search.duplicate_count << " / " << beam_search.generated_count << " states";
+    if (beam_search.generated_count > 0) {
+      std::cerr << " (" << 100.0 * beam_search.duplicate_count / beam_search.generated_count << " %)";
     }
+    std::cerr << std::endl;
+    std::cerr << "-----------------------" << std::endl;
 
-    // 11連鎖を作れなかった場合や、連鎖数 < ターン数の場合には、SKILL型へ移行
-    if (beam_search.score.chain_count < 11 && beam_search.score.chain_count < beam_search.require_turn) {
+    // 連鎖を組む手順として使えない場合には、SKILL型へ移行
+    if (!IsUsablePlan(beam_search)) {
+      while (!action_queue.empty()) {
+        action_queue.pop();
+      }
       mode = SKILL_MODE;
     } else {
-      /**
-       *  何手先まで探索結果を保存するか
-       *   - 0ターン目は発火直前まで保存
-       *   - それ以降は、発火直前 - 3 ターンまで保存
-       *       探索結果が保持されていない場合は、深さ4の全探索を行うため、
-       *       この発火が全探索で発見される
-       * 連鎖を大きくすることよりも、途中で相手を攻撃する方が有力な場合があるため、
-       * 最後まで登録しない。
-       */
-#ifdef SERVER
-      int cache_depth = (game.turn == 0)? beam_search.require_turn - 2 : std::min(7, beam_search.require_turn - 2);
-#else
-      int cache_depth = (game.turn == 0)? beam_search.require_turn - 3 : std::min(7, beam_search.require_turn - 3);
-#endif
-      for (int i = 0; i < cache_depth && i < beam_search.require_turn; i++) {
-        action_queue.push(beam_search.action_sequence[i]);
-      }
+      QueueBeamPlan(beam_search, 0);
     }
 
     beam_search_flag = false;
   }
 
-  if (mode == CHAIN_MODE && !action_queue.empty() && game.ojama_stock[WHITE] < kWIDTH) {
-    // 探索済みのものを使う
-    std::cerr << "cache (" << beam_search.score.chain_count << " chain) [" << (int)sw.Elapsed() << " ms]" << std::endl;
+#ifndef SERVER
+  // 今の手順がお邪魔の段数と合わない場合に限り、先読みで求めた手順に切り替える
+  if (mode == CHAIN_MODE && game.ojama_stock[WHITE] >= kWIDTH && (action_queue.empty() || game.ojama_stock[WHITE] / kWIDTH != planned_ojama_rows)) {
+    AdoptSpeculativePlan();
+  }
+#endif
+
+  // 手順が想定した通りにお邪魔が降っている間は、探索済みのものを使う
+  if (mode == CHAIN_MODE && !action_queue.empty() && game.ojama_stock[WHITE] / kWIDTH == planned_ojama_rows) {
+    std::cerr << "cache (" << planned_score.chain_count << " chain) [" << (int)sw.Elapsed() << " ms]" << std::endl;
 
     Action action = action_queue.front();
     action_queue.pop();
+    if (planned_ojama_rows > 0) {
+      planned_ojama_rows--;
+    }
+    statistics.use_cache = true;
     return action;
   } else {
     // お邪魔が送られるなどして、探索結果が使えなくなった場合は、消去しておく
     beam_search_flag = false;
-    beam_search.score = Score();
+    planned_score = Score();
     while (!action_queue.empty()) {
       action_queue.pop();
     }
   }
 
-  DepthFirstSearch dfs;
+  SearchContext context;
+  context.EvaluateRoot();
 
   // 相手の連鎖について計算しておく
+  // 2つの表は並行して計算し、終了を待たずに自分の探索を始める (表の値が必要になった節点で待つ)
+  OpponentTables op_tables;
+  context.op_tables = &op_tables;
 #ifdef SERVER
-  dfs.FillOutOpScoreTable(g.positions[BLACK], 0, 3, g.ojama_stock[BLACK]);
-  dfs.FillOutOpDamagedScoreTable(g.positions[BLACK], 0, 3);
+  op_tables.FillOutOpScoreTable(g.positions[BLACK], 0, 3, g.ojama_stock[BLACK]);
+  op_tables.FillOutOpDamagedScoreTable(g.positions[BLACK], 0, 3);
 #else
-  dfs.FillOutOpScoreTable(g.positions[BLACK], 0, 4, g.ojama_stock[BLACK], true);
-  dfs.FillOutOpDamagedScoreTable(g.positions[BLACK], 0, 4, true);
+  op_tables.FillOutOpScoreTable(g.positions[BLACK], 0, 4, g.ojama_stock[BLACK], true);
+  op_tables.FillOutOpDamagedScoreTable(g.positions[BLACK], 0, 4, true);
+#endif
+
+  DepthFirstSearch dfs(context);
+
+#ifndef SERVER
+  // 相手の連鎖を計算するのに使った時間も含めて、このターンの持ち時間に収める
+  // ビームサーチの時間は、別に割り当てているので含めない
+  statistics.time_budget = TimeManager::TurnBudget(game, TimeManager::IsCritical(game, op_tables.OpScore(0)));
+  deadline.Start(statistics.time_budget - (sw.Elapsed() - statistics.beam_elapsed));
 #endif
 
 THINK:
@@ -953,9 +1701,15 @@ THINK:
     dfs.SkillSearch(game.skills[WHITE], 0, 3);
   }
 #else
-  int depth = (game.remain_time[WHITE] > 20 * 1000)? 4 : 3;  // 時間が20秒以上ある場合は深さ4、なければ深さ3の探索を行う
   if (mode == CHAIN_MODE) {
-    dfs.ChainSearch(0, depth, true);
+    // 前のターンの読み筋通りに進んでいれば、その手を先に探索する
+    dfs.first_actions[1] = (predicted_turn == game.turn)? predicted_action : Action();
+
+    IterativeSearch(dfs, [&dfs](int depth_max) { dfs.ChainSearch(0, depth_max, true); }, true);
+
+    predicted_action = dfs.next_action;
+    predicted_turn = game.turn + 1;
+
     if (dfs.score.GetScoreSum() < 20 && game.ojama_stock[WHITE] >= 3 * kWIDTH) {
       // 有力な連鎖が見つからない場合
       // お邪魔が降ってくる場合は、スキル型へ移行
@@ -967,7 +1721,7 @@ THINK:
       beam_search_flag = true;
     }
   } else {
-    dfs.SkillSearch(game.skills[WHITE], 0, depth, true);
+    IterativeSearch(dfs, [&dfs](int depth_max) { dfs.SkillSearch(game.skills[WHITE], 0, depth_max, true); }, false);
   }
 #endif
 
@@ -986,6 +1740,7 @@ THINK:
   std::cerr << "  score:" << dfs.score.GetScoreSum() << std::endl;
   std::cerr << "  chain: " << dfs.score.chain_count << std::endl;
   std::cerr << "  explosion_score: " << dfs.score.explosion_score << std::endl;
+  std::cerr << "  depth: " << statistics.search_depth << std::endl;
   std::cerr << "  elapsed: " << (int)sw.Elapsed() << " ms" << std::endl;
 
   if (dfs.action.action_type == SKILL) {
@@ -995,3 +1750,154 @@ THINK:
 
   return dfs.action;
 }
+
+#ifndef SERVER
+/**
+ * 先読みの1段階を始める。
+ * 期限を設定してから打ち切りを確認するので、StopPondering()のdeadline.Stop()を取りこぼさない。
+ * 打ち切られていた場合はfalseを返す。
+ */
+bool BeginPonderStep() {
+  deadline.Start(kPONDER_TIME_LIMIT);
+  return !ponder_stopped;
+}
+
+/**
+ * 先読みの本体 (ponder_threadで実行する)
+ * next_gameは、自分が行動した後の次のターンの入力の予想で、降ってくるお邪魔の数は含まない。
+ *
+ * 次のターンにビームサーチを行う予定であれば、まずその続きを進めておく (次のSearch()で引き継がれる)。
+ * ビームサーチを行う予定の場合と、ビームサーチの手順を指している途中の場合は、
+ * お邪魔が1段からkPONDER_OJAMA_ROW_NUM - 1段降る場合のビームサーチも並行して行い、
+ * 実際にその段数のお邪魔が降ってきた場合には、深さ優先探索の代わりにその手順を使う。
+ * その後、お邪魔が0段からkPONDER_OJAMA_ROW_NUM - 1段降る場合のそれぞれについて、深さ優先探索を浅い順に行う。
+ * 相手の次の局面はわからないので、相手の連鎖の表は空のまま探索し、
+ * 結果のうち、相手によらない末端の評価値 (置換表) のみが次のSearch()で使われる。
+ */
+void Ponder(Game next_game) {
+  if (mode == CHAIN_MODE && (beam_search_flag || !action_queue.empty()) && TimeManager::BeamBudget(next_game) > 0 && next_game.positions[WHITE].GetPackedCells(5) == 0ULL) {
+    game = next_game;
+    if (!BeginPonderStep()) {
+      return;
+    }
+
+    // お邪魔が降る場合の探索は、それぞれ別のスレッドから始める (展開はどちらもスレッドプールで行う)
+    std::vector<std::thread> speculations;
+    for (int rows = 1; rows < kPONDER_OJAMA_ROW_NUM; rows++) {
+      speculations.emplace_back([rows]() { RunBeamSearch(speculative_beam_searches[rows], rows); });
+    }
+
+    // お邪魔が降る局面では、Search()はbeam_searchを使わないので、降らない場合の探索は行わない
+    if (beam_search_flag && next_game.ojama_stock[WHITE] < kWIDTH) {
+      RunBeamSearch();
+    }
+
+    for (auto& speculation : speculations) {
+      speculation.join();
+    }
+  }
+
+  const int ojama_stock = next_game.ojama_stock[WHITE];
+  for (int depth_max = kMIN_ITERATION_DEPTH; depth_max <= kMAX_SEARCH_DEPTH; depth_max++) {
+    for (int rows = 0; rows < kPONDER_OJAMA_ROW_NUM; rows++) {
+      game = next_game;
+      game.ojama_stock[WHITE] = ojama_stock + rows * kWIDTH;
+      search_generation++;
+      search_interrupted = false;
+
+      if (!BeginPonderStep()) {
+        return;
+      }
+
+      SearchContext context;
+      context.EvaluateRoot();
+
+      OpponentTables op_tables;
+      context.op_tables = &op_tables;
+
+      DepthFirstSearch dfs(context);
+      dfs.position = game.positions[WHITE];
+      dfs.ojama_stock = game.ojama_stock[WHITE];
+      dfs.ChainSearch(0, depth_max, true);
+    }
+  }
+}
+#endif
+
+}  // namespace
+
+Action Think::Start(const Game& g) {
+  Stopwatch sw;
+  sw.Start();
+
+  Stats::Clear();
+  statistics = Statistics();
+
+  Action action = Search(g);
+  beam_search.Record(g.turn, action);
+
+  statistics.elapsed = sw.Elapsed();
+  statistics.simulate_count = Stats::Sum(Stats::SIMULATE_COUNT);
+  statistics.search_node_count = Stats::SumSearchNodes();
+
+#ifdef STATS
+  // 集計用に、1ターン分のカウンタを1行で出力する
+  std::cerr << "stats turn=" << g.turn << " elapsed_ms=" << (int)statistics.elapsed << " " << Stats::Format() << std::endl;
+#endif
+
+  return action;
+}
+
+void Think::StartPondering(const Game& g, const Action& action) {
+#ifdef SERVER
+  // 軽量版は1スレッドのみを使うので、先読みは行わない
+  (void)g;
+  (void)action;
+#else
+  StopPondering();
+
+  // 次のターンの入力を予想する (スキルゲージや得点などは、探索する局面には影響しないので更新しない)
+  Game next_game = g;
+  next_game.turn = g.turn + 1;
+
+  Position& position = next_game.positions[WHITE];
+  if (next_game.ojama_stock[WHITE] >= kWIDTH) {
+    position.Attacked();
+    next_game.ojama_stock[WHITE] -= kWIDTH;
+  }
+  if (action.action_type == SKILL) {
+    position.Simulate(Pack(), action);
+  } else {
+    position.Simulate(g.packs[g.turn], action);
+  }
+
+  if (position.IsGameOver()) {
+    return;
+  }
+
+  ponder_stopped = false;
+  pondering = true;
+  ponder_thread = std::thread(Ponder, next_game);
+#endif
+}
+
+void Think::StopPondering() {
+#ifndef SERVER
+  if (!ponder_thread.joinable()) {
+    return;
+  }
+
+  ponder_stopped = true;
+  deadline.Stop();
+  ponder_thread.join();
+  pondering = false;
+#endif
+}
+
+void Think::SetSearchDepth(int depth) {
+  fixed_search_depth = std::min(depth, kMAX_SEARCH_DEPTH);
+}
+
+const Think::Statistics& Think::GetStatistics() {
+  return statistics;
+}
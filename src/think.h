@@ -4,11 +4,62 @@
 #include "game.h"
 #include "action.h"
 
+#include <cinttypes>
+
 namespace Think {
 
-void Init();
+const int kDEFAULT_THREAD_NUM = 16;  // 探索に用いるスレッド数の既定値
+
+/**
+ * 直前のStart()での探索の統計
+ */
+struct Statistics {
+  double elapsed;  // 思考時間 (ミリ秒)
+  int64_t simulate_count;  // 落下処理を行った局面の数
+  int64_t search_node_count;  // 深さ優先探索で展開した節点の数
+  bool use_cache;  // ビームサーチで求めた手順をそのまま返したかどうか
+  double time_budget;  // このターンの持ち時間 (ミリ秒)
+  int search_depth;  // 深さ優先探索で最後まで探索した深さ
+  bool search_timeout;  // 持ち時間のために、反復深化を打ち切ったかどうか
+
+  // ビームサーチを行っていない場合は、全て0となる
+  double beam_elapsed;  // ビームサーチに掛かった時間 (ミリ秒)
+  int beam_depth;  // 展開した深さ
+  int beam_width;  // 保持した状態の数の最大値
+  bool beam_timeout;  // 時間切れで打ち切ったかどうか
+  int beam_reused_depth;  // 前回のビームサーチから引き継いだ深さ (引き継いでいない場合は0)
+};
+
+/**
+ * 初期化
+ * thread_numは探索に用いるスレッド数 (呼び出し元のスレッドを含む)。
+ */
+void Init(int thread_num = kDEFAULT_THREAD_NUM);
 Action Start(const Game& game);
 
+/**
+ * 相手の思考中に、次のターンの探索を先に進めておく (先読み)。
+ * gameで自分がactionを行った後の局面について、ビームサーチの続き (お邪魔が降ってくる場合を想定したものを含む) と、
+ * お邪魔が降ってくる場合も含めた深さ優先探索を、StopPondering()が呼ばれるまで別のスレッドで行う。
+ * 結果は置換表とビームサーチの状態に残り、次のStart()で局面とお邪魔の段数が一致すればそのまま使われる。
+ */
+void StartPondering(const Game& game, const Action& action);
+
+/**
+ * 先読みを打ち切り、終了するまで待つ。
+ * 先読みをしていない場合は何もしない。
+ */
+void StopPondering();
+
+/**
+ * 深さ優先探索の深さを、時間に関わらずdepthに固定する。
+ * 0 (既定値) の場合は、持ち時間に応じて反復深化で決める。
+ * 結果を再現させたい計測などで用いる。
+ */
+void SetSearchDepth(int depth);
+
+const Statistics& GetStatistics();
+
 }  // Think
 
 #endif  // THINK_H_
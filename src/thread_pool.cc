@@ -0,0 +1,235 @@
+#include "thread_pool.h"
+#include "stats.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Task {
+  std::function<void()> func;
+  TaskGroup* group;
+};
+
+/**
+ * ワーカーごとの待ち行列
+ * 持ち主は末尾から取り出し、他のスレッドは先頭から盗む。
+ */
+struct alignas(64) WorkQueue {
+  std::mutex mtx;
+  std::deque<Task> tasks;
+};
+
+class Pool {
+private:
+  std::vector<std::unique_ptr<WorkQueue>> queues;  // queues[0]は使わない (ワーカー番号と揃えるため)
+  std::vector<std::thread> workers;
+
+  std::mutex sleep_mtx;
+  std::condition_variable sleep_cv;
+
+  std::atomic<int> queued;  // 待ち行列に積まれているタスクの総数
+  std::atomic<unsigned> next_queue;  // ワーカー以外から登録する際の、登録先の待ち行列
+  bool stop;
+
+public:
+  Pool(): queued(0), next_queue(0), stop(false) { }
+  ~Pool() { Shutdown(); }
+
+  void Start(int thread_num);
+  void Shutdown();
+
+  int ThreadNum() const { return workers.size() + 1; }
+
+  void Submit(TaskGroup& group, std::function<void()> func);
+
+  /**
+   * 待ち行列からタスクを1つ取り出して実行する。
+   * 実行できるタスクがなかった場合はfalseを返す。
+   */
+  bool RunOneTask();
+
+  /**
+   * predicateが真になるか、新しいタスクが積まれるまで眠る。
+   */
+  template <class Predicate>
+  void Sleep(Predicate predicate) {
+    std::unique_lock<std::mutex> lk(sleep_mtx);
+    sleep_cv.wait(lk, [this, &predicate]() { return stop || queued.load() > 0 || predicate(); });
+  }
+
+  void NotifyAll() {
+    std::lock_guard<std::mutex> lk(sleep_mtx);
+    sleep_cv.notify_all();
+  }
+
+private:
+  void WorkerLoop(int index);
+  bool Pop(int index, Task& task);
+  bool Steal(int index, Task& task);
+};
+
+Pool pool;
+thread_local int thread_index = 0;
+
+void Pool::Start(int thread_num) {
+  Shutdown();
+
+  stop = false;
+  queues.clear();
+  for (int i = 0; i < std::max(thread_num, 1); i++) {
+    queues.emplace_back(new WorkQueue());
+  }
+
+  for (int i = 1; i < thread_num; i++) {
+    workers.emplace_back(&Pool::WorkerLoop, this, i);
+  }
+}
+
+void Pool::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lk(sleep_mtx);
+    stop = true;
+    sleep_cv.notify_all();
+  }
+
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  workers.clear();
+}
+
+void Pool::Submit(TaskGroup& group, std::function<void()> func) {
+  group.Add();
+
+  if (workers.empty()) {
+    // ワーカーがいない場合は、その場で実行する
+    func();
+    group.Done();
+    return;
+  }
+
+  int index = thread_index;
+  if (index == 0) {
+    index = 1 + next_queue.fetch_add(1) % workers.size();
+  }
+
+  {
+    Stats::LockGuard<std::mutex> lk(queues[index]->mtx);
+    queues[index]->tasks.push_back(Task{ std::move(func), &group });
+  }
+  queued++;
+
+  {
+    std::lock_guard<std::mutex> lk(sleep_mtx);
+    sleep_cv.notify_one();
+  }
+}
+
+bool Pool::Pop(int index, Task& task) {
+  WorkQueue& queue = *queues[index];
+  Stats::LockGuard<std::mutex> lk(queue.mtx);
+  if (queue.tasks.empty()) {
+    return false;
+  }
+
+  task = std::move(queue.tasks.back());
+  queue.tasks.pop_back();
+  return true;
+}
+
+bool Pool::Steal(int index, Task& task) {
+  const int queue_num = queues.size();
+  for (int i = 1; i < queue_num; i++) {
+    WorkQueue& queue = *queues[(index + i) % queue_num];
+    Stats::LockGuard<std::mutex> lk(queue.mtx);
+    if (queue.tasks.empty()) {
+      continue;
+    }
+
+    task = std::move(queue.tasks.front());
+    queue.tasks.pop_front();
+    return true;
+  }
+
+  return false;
+}
+
+bool Pool::RunOneTask() {
+  if (queued.load() == 0) {
+    return false;
+  }
+
+  Task task;
+  if (!Pop(thread_index, task) && !Steal(thread_index, task)) {
+    return false;
+  }
+  queued--;
+
+  task.func();
+  task.group->Done();
+  return true;
+}
+
+void Pool::WorkerLoop(int index) {
+  thread_index = index;
+
+  while (true) {
+    if (RunOneTask()) {
+      continue;
+    }
+
+    Sleep([]() { return false; });
+
+    std::lock_guard<std::mutex> lk(sleep_mtx);
+    if (stop) {
+      return;
+    }
+  }
+}
+
+}  // namespace
+
+void TaskGroup::Wait() {
+  while (!IsFinished()) {
+    if (pool.RunOneTask()) {
+      continue;
+    }
+
+    pool.Sleep([this]() { return IsFinished(); });
+  }
+}
+
+void TaskGroup::Add() {
+  pending_++;
+}
+
+void TaskGroup::Done() {
+  if (--pending_ == 0) {
+    pool.NotifyAll();
+  }
+}
+
+bool TaskGroup::IsFinished() const {
+  return pending_.load() == 0;
+}
+
+void ThreadPool::Init(int thread_num) {
+  pool.Start(thread_num);
+}
+
+void ThreadPool::Submit(TaskGroup& group, std::function<void()> func) {
+  pool.Submit(group, std::move(func));
+}
+
+int ThreadPool::ThreadNum() {
+  return pool.ThreadNum();
+}
+
+int ThreadPool::ThreadIndex() {
+  return thread_index;
+}
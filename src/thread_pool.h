@@ -0,0 +1,62 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <atomic>
+#include <functional>
+
+/**
+ * ThreadPoolに登録したタスクの集合。
+ * Wait()を呼ぶと、登録したタスクが全て終了するまで待つ。
+ */
+class TaskGroup {
+private:
+  std::atomic<int> pending_;  // 終了していないタスクの数
+
+public:
+  TaskGroup(): pending_(0) { }
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  /**
+   * 登録したタスクが全て終了するまで待つ。
+   * 待っている間は、待ち行列にあるタスクを代わりに実行する。
+   */
+  void Wait();
+
+  void Add();
+  void Done();
+  bool IsFinished() const;
+};
+
+/**
+ * プロセス全体で1つだけ存在する、work stealing型のスレッドプール。
+ * 各ワーカーは自分の待ち行列を持ち、空になった場合は他のワーカーの待ち行列からタスクを盗む。
+ */
+namespace ThreadPool {
+
+/**
+ * 初期化
+ * thread_numは呼び出し元のスレッドを含めたスレッド数で、thread_num - 1個のワーカーを生成する。
+ * thread_num <= 1の場合、タスクは登録時にその場で実行される。
+ */
+void Init(int thread_num);
+
+/**
+ * タスクをgroupに登録する。
+ */
+void Submit(TaskGroup& group, std::function<void()> func);
+
+/**
+ * 呼び出し元のスレッドを含めたスレッド数を返す。
+ */
+int ThreadNum();
+
+/**
+ * 現在のスレッドの番号を返す。
+ * ワーカー以外のスレッドは0、ワーカーは1からThreadNum() - 1までの値となる。
+ */
+int ThreadIndex();
+
+}  // namespace ThreadPool
+
+#endif  // THREAD_POOL_H_
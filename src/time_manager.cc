@@ -0,0 +1,57 @@
+#include "time_manager.h"
+#include "types.h"
+
+#include <algorithm>
+
+namespace {
+
+const int kEXPECTED_TURN_NUM = 45;  // 1試合のターン数の見込み
+const int kMIN_REMAIN_TURN_NUM = 10;  // 残りのターン数の見込みの下限
+const double kRESERVE_TIME = 5000;  // 使わずに残しておく時間 (ms)
+const double kCRITICAL_RATIO = 3.0;  // 危険な局面で、基本の持ち時間の何倍を使うか
+const double kMAX_TURN_RATIO = 0.25;  // 1ターンに使える時間の、使える時間全体に対する割合の上限
+
+const double kBEAM_TIME_LIMIT = 18000;  // ビームサーチに使う時間の上限 (ms)
+const double kBEAM_TIME_RATIO = 0.1;  // ビームサーチに使う時間の、残り時間に対する割合
+const double kMIN_BEAM_TIME = 4000;  // これ以下の時間しかない場合は、ビームサーチを行わない
+
+const int kCRITICAL_HEIGHT = kDANGER_HEIGHT - 7;  // これより高く積まれている場合は危険とみなす
+
+}  // namespace
+
+bool TimeManager::IsCritical(const Game& game, const Score& op_score) {
+  // お邪魔が降ってくる
+  if (game.ojama_stock[WHITE] >= kWIDTH) {
+    return true;
+  }
+
+  // 上の方まで積みあがっている
+  if (game.positions[WHITE].GetMaxHeight() > kCRITICAL_HEIGHT) {
+    return true;
+  }
+
+  // 相手が大きな連鎖やスキルを使える
+  if (op_score.chain_count >= 11 || game.skills[BLACK] >= 80) {
+    return true;
+  }
+
+  return false;
+}
+
+double TimeManager::TurnBudget(const Game& game, bool critical) {
+  const double available = std::max(0.0, game.remain_time[WHITE] - kRESERVE_TIME);
+  const int remain_turn_num = std::max(kMIN_REMAIN_TURN_NUM, kEXPECTED_TURN_NUM - game.turn);
+
+  double budget = available / remain_turn_num;
+  if (critical) {
+    budget *= kCRITICAL_RATIO;
+  }
+
+  return std::min(budget, available * kMAX_TURN_RATIO);
+}
+
+double TimeManager::BeamBudget(const Game& game) {
+  // 持ち時間180秒のうち18秒を上限として、残り時間に応じて使う時間を決める
+  double budget = std::min(kBEAM_TIME_LIMIT, game.remain_time[WHITE] * kBEAM_TIME_RATIO);
+  return (budget > kMIN_BEAM_TIME)? budget : 0;
+}
@@ -0,0 +1,35 @@
+#ifndef TIME_MANAGER_H_
+#define TIME_MANAGER_H_
+
+#include "game.h"
+#include "score.h"
+
+/**
+ * 持ち時間の配分
+ *
+ * 残り時間を、残りのターン数の見込みで割ったものを1ターンの基本の持ち時間とし、
+ * お邪魔が降ってくる、相手が大きな連鎖を持っているなどの危険な局面では多めに使う。
+ * 最後に時間切れにならないよう、kRESERVE_TIMEは常に残しておく。
+ */
+namespace TimeManager {
+
+/**
+ * このターンが危険な局面かどうかを返す。
+ * op_scoreは、相手が次のターンに獲得できる点数。
+ */
+bool IsCritical(const Game& game, const Score& op_score);
+
+/**
+ * このターンの探索に使う時間 (ミリ秒) を返す。
+ */
+double TurnBudget(const Game& game, bool critical);
+
+/**
+ * ビームサーチに使う時間 (ミリ秒) を返す。
+ * ビームサーチを行うほどの時間がない場合は0を返す。
+ */
+double BeamBudget(const Game& game);
+
+}  // namespace TimeManager
+
+#endif  // TIME_MANAGER_H_
@@ -0,0 +1,134 @@
+#include "transposition.h"
+
+void TranspositionSet::Reserve(uint64_t size) {
+  uint64_t capacity = 1;
+  while (capacity < 2 * size) {
+    capacity <<= 1;
+  }
+
+  if (capacity <= mask_ + 1 && entries_) {
+    return;
+  }
+
+  entries_.reset(new std::atomic<uint64_t>[capacity]);
+  for (uint64_t i = 0; i < capacity; i++) {
+    entries_[i].store(0, std::memory_order_relaxed);
+  }
+  mask_ = capacity - 1;
+  generation_ = 1;
+}
+
+void TranspositionSet::NextGeneration() {
+  generation_++;
+
+  if (generation_ > 0xFF) {
+    // 世代が一周したら、全ての要素を消去する
+    for (uint64_t i = 0; i <= mask_; i++) {
+      entries_[i].store(0, std::memory_order_relaxed);
+    }
+    generation_ = 1;
+  }
+}
+
+bool TranspositionSet::Insert(uint64_t hash) {
+  const uint64_t key = (hash & ~0xFFULL) | generation_;
+
+  for (uint64_t i = 0; i < kPROBE_MAX; i++) {
+    std::atomic<uint64_t>& entry = entries_[((hash >> 8) + i) & mask_];
+
+    uint64_t current = entry.load(std::memory_order_relaxed);
+    while ((current & 0xFFULL) != generation_) {
+      // 古い世代の要素は空とみなして上書きする
+      if (entry.compare_exchange_weak(current, key, std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+
+    if (current == key) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+namespace {
+
+uint64_t Mix(uint64_t x) {
+  // splitmix64
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+}  // namespace
+
+void TranspositionTable::Resize(int bits) {
+  const uint64_t capacity = 1ULL << bits;
+  entries_.reset(new Entry[capacity]);
+  mask_ = capacity - 1;
+  Clear();
+}
+
+void TranspositionTable::Clear() {
+  for (uint64_t i = 0; i <= mask_; i++) {
+    entries_[i].check.store(0, std::memory_order_relaxed);
+    entries_[i].data[0].store(0, std::memory_order_relaxed);
+    entries_[i].data[1].store(0, std::memory_order_relaxed);
+  }
+}
+
+uint64_t TranspositionTable::MakeKey(uint64_t hash, int64_t condition1, int64_t condition2, int64_t condition3) {
+  uint64_t key = hash;
+  key ^= Mix(condition1);
+  key ^= Mix(key ^ condition2);
+  key ^= Mix(key ^ condition3);
+
+  // キー0は空の要素と区別できないので使わない
+  return (key == 0ULL)? 1ULL : key;
+}
+
+bool TranspositionTable::Probe(uint64_t key, Score* score, Action* action) const {
+  if (!entries_) {
+    return false;
+  }
+
+  const Entry& entry = entries_[key & mask_];
+  const uint64_t data0 = entry.data[0].load(std::memory_order_relaxed);
+  const uint64_t data1 = entry.data[1].load(std::memory_order_relaxed);
+  const uint64_t check = entry.check.load(std::memory_order_relaxed);
+
+  if ((check ^ data0 ^ data1) != key) {
+    return false;
+  }
+
+  score->chain_score = (int32_t)(uint32_t)data0;
+  score->explosion_score = (int32_t)(uint32_t)(data0 >> 32);
+  score->heuristic_score = (int32_t)(uint32_t)data1;
+  score->chain_count = (data1 >> 32) & 0xFF;
+
+  if (action != nullptr) {
+    *action = Action((ActionType)((data1 >> 56) & 0xFF), (int)((data1 >> 48) & 0xFF) - 1, (int)((data1 >> 40) & 0xFF) - 1);
+  }
+
+  return true;
+}
+
+void TranspositionTable::Store(uint64_t key, const Score& score, const Action& action) {
+  if (!entries_) {
+    return;
+  }
+
+  const uint64_t data0 = (uint64_t)(uint32_t)score.chain_score | ((uint64_t)(uint32_t)score.explosion_score << 32);
+  const uint64_t data1 = (uint64_t)(uint32_t)score.heuristic_score |
+                         ((uint64_t)(score.chain_count & 0xFF) << 32) |
+                         ((uint64_t)((action.rotate + 1) & 0xFF) << 40) |
+                         ((uint64_t)((action.column + 1) & 0xFF) << 48) |
+                         ((uint64_t)(action.action_type & 0xFF) << 56);
+
+  Entry& entry = entries_[key & mask_];
+  entry.data[0].store(data0, std::memory_order_relaxed);
+  entry.data[1].store(data1, std::memory_order_relaxed);
+  entry.check.store(key ^ data0 ^ data1, std::memory_order_relaxed);
+}
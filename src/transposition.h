@@ -0,0 +1,95 @@
+#ifndef TRANSPOSITION_H_
+#define TRANSPOSITION_H_
+
+#include <atomic>
+#include <cinttypes>
+#include <memory>
+
+#include "action.h"
+#include "score.h"
+
+/**
+ * 複数スレッドから同時に使える、局面のハッシュ値の集合。
+ * ビームサーチで、同じ深さに現れた同一局面を取り除くために用いる。
+ *
+ * 各要素は上位56bitにハッシュ値、下位8bitに世代を持ち、
+ * 古い世代の要素は空として扱う。そのため、NextGeneration()を呼ぶだけで集合を空にできる。
+ */
+class TranspositionSet {
+private:
+  std::unique_ptr<std::atomic<uint64_t>[]> entries_;
+  uint64_t mask_;
+  uint64_t generation_;
+
+  static const int kPROBE_MAX = 32;  // 線形探索で調べる要素数の上限
+
+public:
+  TranspositionSet(): mask_(0), generation_(1) { }
+
+  /**
+   * 少なくともsize個の要素を格納できるように確保する。
+   * 確保し直した場合は、集合は空になる。
+   */
+  void Reserve(uint64_t size);
+
+  /**
+   * 集合を空にする。
+   */
+  void NextGeneration();
+
+  /**
+   * hashを集合に追加する。
+   * 既に含まれていた場合はfalseを返す。
+   * 表が埋まっていて追加できなかった場合は、含まれていないものとしてtrueを返す。
+   */
+  bool Insert(uint64_t hash);
+};
+
+/**
+ * 複数スレッドから同時に使える、固定サイズの置換表。
+ * 深さ優先探索で、異なる手順で到達した同一局面の探索結果を使い回すために用いる。
+ *
+ * 各要素は(検査値, データ1, データ2)の3語からなり、検査値にはキーと2つのデータのxorを格納する。
+ * 書き込みが競合して壊れた要素は検査値が一致しなくなるため、ロックを用いずに読み書きできる。
+ */
+class TranspositionTable {
+private:
+  struct Entry {
+    std::atomic<uint64_t> check;
+    std::atomic<uint64_t> data[2];
+  };
+
+  std::unique_ptr<Entry[]> entries_;
+  uint64_t mask_;
+
+public:
+  TranspositionTable(): mask_(0) { }
+
+  /**
+   * 2^bits個の要素を確保する。
+   */
+  void Resize(int bits);
+
+  /**
+   * 全ての要素を消去する。
+   */
+  void Clear();
+
+  /**
+   * 局面のハッシュ値と探索条件からキーを作る。
+   */
+  static uint64_t MakeKey(uint64_t hash, int64_t condition1, int64_t condition2 = 0, int64_t condition3 = 0);
+
+  /**
+   * keyに対応する探索結果を取り出す。
+   * 見つからなかった場合はfalseを返す。
+   */
+  bool Probe(uint64_t key, Score* score, Action* action = nullptr) const;
+
+  /**
+   * keyに対応する探索結果を格納する。既に格納されている要素は常に上書きする。
+   */
+  void Store(uint64_t key, const Score& score, const Action& action = Action(NO_ACTION_TYPE));
+};
+
+#endif  // TRANSPOSITION_H_